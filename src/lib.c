@@ -10,9 +10,11 @@
  */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <linux/netlink.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "lib.h"
 
@@ -43,6 +45,13 @@ libnetlink_destroy_socket(int fd)
 	close(fd);
 }
 
+int
+libnetlink_add_membership(int fd, unsigned int group)
+{
+	return setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+			  &group, sizeof(group));
+}
+
 int
 libnetlink_send(int fd, struct nlmsghdr *nlh)
 {
@@ -55,6 +64,13 @@ libnetlink_recv(int fd, void *data, int size)
 	return recv(fd, data, size, 0);
 }
 
+/* with MSG_TRUNC the full length is returned even if it exceeds @size */
+int
+libnetlink_recv_flags(int fd, void *data, int size, int flags)
+{
+	return recv(fd, data, size, flags);
+}
+
 struct nlmsghdr *libnetlink_newmsg(int type, unsigned int flags, int size)
 {
 	struct nlmsghdr *nlh;
@@ -80,3 +96,211 @@ libnetlink_addattr(struct nlmsghdr *nlh, int type, const void *data, int alen)
 	memcpy(NLA_DATA(attr), data, alen);
 	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(len);
 }
+
+int
+libnetlink_parse(const struct nlmsghdr *nlh, struct nlattr *tb[], int max)
+{
+	struct nlattr *attr = NLMSG_DATA(nlh);
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(0);
+
+	memset(tb, 0, sizeof(struct nlattr *) * (max + 1));
+
+	for (; NLA_OK(attr, len); attr = NLA_NEXT(attr, len)) {
+		int type = attr->nla_type & NLA_TYPE_MASK;
+
+		if (type <= max)
+			tb[type] = attr;
+	}
+	return len > 0 ? -1 : 0;
+}
+
+void
+libnetlink_buf_init(struct libnetlink_buf *b, void *data, unsigned int size,
+		    uint32_t seq)
+{
+	b->data = data;
+	b->size = size;
+	b->len = 0;
+	b->count = 0;
+	b->seq = seq;
+	b->cur = NULL;
+}
+
+/* start a new message right after the last one packed in @b */
+struct nlmsghdr *
+libnetlink_buf_msg(struct libnetlink_buf *b, int type, unsigned int flags)
+{
+	struct nlmsghdr *nlh;
+
+	if (b->len + NLMSG_HDRLEN > b->size) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+
+	nlh = (struct nlmsghdr *)(b->data + b->len);
+	memset(nlh, 0, NLMSG_HDRLEN);
+	nlh->nlmsg_len = NLMSG_LENGTH(0);
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_seq = b->seq++;
+
+	b->len += NLMSG_HDRLEN;
+	b->count++;
+	b->cur = nlh;
+	return nlh;
+}
+
+static void *
+buf_reserve(struct libnetlink_buf *b, int len)
+{
+	void *tail;
+
+	if (b->cur == NULL || len < 0 || NLA_ALIGN(len) > b->size - b->len) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+
+	tail = b->data + b->len;
+	b->len += NLA_ALIGN(len);
+	b->cur->nlmsg_len = NLMSG_ALIGN(b->cur->nlmsg_len) + NLA_ALIGN(len);
+	return tail;
+}
+
+int
+libnetlink_buf_attr(struct libnetlink_buf *b, int type, const void *data,
+		    int alen)
+{
+	struct nlattr *attr;
+
+	/* nla_len is 16 bits wide */
+	if (alen > 0xffff - NLA_HDRLEN) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	attr = buf_reserve(b, NLA_LENGTH(alen));
+	if (attr == NULL)
+		return -1;
+
+	attr->nla_type = type;
+	attr->nla_len = NLA_LENGTH(alen);
+	if (alen > 0)
+		memcpy(NLA_DATA(attr), data, alen);
+	/* do not leak stale bytes through the padding */
+	memset((char *)attr + attr->nla_len, 0,
+	       NLA_ALIGN(attr->nla_len) - attr->nla_len);
+	return 0;
+}
+
+struct nlattr *
+libnetlink_buf_nest_start(struct libnetlink_buf *b, int type)
+{
+	struct nlattr *nest;
+
+	nest = buf_reserve(b, NLA_LENGTH(0));
+	if (nest == NULL)
+		return NULL;
+
+	nest->nla_type = type | NLA_F_NESTED;
+	nest->nla_len = NLA_LENGTH(0);
+	return nest;
+}
+
+/* a nest too long for nla_len is dropped along with all it holds */
+int
+libnetlink_buf_nest_end(struct libnetlink_buf *b, struct nlattr *nest)
+{
+	unsigned int len = b->data + b->len - (char *)nest;
+
+	if (len > 0xffff) {
+		b->len -= len;
+		b->cur->nlmsg_len -= len;
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	nest->nla_len = len;
+	return 0;
+}
+
+/* hand every packed message to the kernel in one go */
+int
+libnetlink_buf_send(int fd, const struct libnetlink_buf *b)
+{
+	struct sockaddr_nl peer = {
+		.nl_family	= AF_NETLINK,
+	};
+	struct iovec iov = {
+		.iov_base	= b->data,
+		.iov_len	= b->len,
+	};
+	struct msghdr msg = {
+		.msg_name	= &peer,
+		.msg_namelen	= sizeof(peer),
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+	};
+
+	return sendmsg(fd, &msg, 0);
+}
+
+static int
+parse_level(const struct nlattr *attr, int len, int depth, int parent,
+	    struct libnetlink_attr_table *tab, int maxdepth)
+{
+	struct libnetlink_attr_ent *ent;
+	int idx;
+
+	if (depth > maxdepth) {
+		errno = ELOOP;
+		return -1;
+	}
+
+	for (; NLA_OK(attr, len); attr = NLA_NEXT(attr, len)) {
+		if (tab->count == LIBNETLINK_TABLE_MAX) {
+			errno = E2BIG;
+			return -1;
+		}
+		idx = tab->count++;
+		ent = &tab->ent[idx];
+		ent->attr = attr;
+		ent->type = attr->nla_type & NLA_TYPE_MASK;
+		ent->depth = depth;
+		ent->parent = parent;
+
+		if ((attr->nla_type & NLA_F_NESTED) &&
+		    parse_level(NLA_DATA(attr), attr->nla_len - NLA_HDRLEN,
+				depth + 1, idx, tab, maxdepth) < 0)
+			return -1;
+	}
+	/* trailing bytes that do not form an attribute */
+	if (len > 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Validate every attribute after the @hdrlen bytes of family header and
+ * index them, nested ones included, in @tab. Returns the number of
+ * attributes or -1 with errno set.
+ */
+int
+libnetlink_parse_table(const struct nlmsghdr *nlh, int hdrlen,
+		       struct libnetlink_attr_table *tab, int maxdepth)
+{
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(hdrlen));
+
+	tab->count = 0;
+
+	if (len < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (parse_level(NLMSG_DATA(nlh) + NLMSG_ALIGN(hdrlen), len, 0, -1,
+			tab, maxdepth) < 0)
+		return -1;
+
+	return tab->count;
+}
@@ -1,17 +1,72 @@
 #ifndef _LIB_H_
 #define _LIB_H_
 
+#include <stdint.h>
+
 int libnetlink_create_socket(int id, unsigned int groups);
 int libnetlink_destroy_socket(int id);
+int libnetlink_add_membership(int fd, unsigned int group);
 int libnetlink_send(int fd, struct nlmsghdr *nlh);
 int libnetlink_recv(int fd, void *data, int size);
+int libnetlink_recv_flags(int fd, void *data, int size, int flags);
 
 struct nlmsghdr *libnetlink_newmsg(int type, unsigned int flags, int size);
+void libnetlink_addattr(struct nlmsghdr *nlh, int type,
+			const void *data, int alen);
+int libnetlink_parse(const struct nlmsghdr *nlh, struct nlattr *tb[], int max);
+
+/*
+ * Message builder over a caller-supplied buffer: nothing is allocated,
+ * appends that do not fit fail with EMSGSIZE and leave the buffer intact,
+ * so do attributes and nests longer than the 16-bit nla_len. Several
+ * messages may be packed and then sent with a single sendmsg().
+ */
+struct libnetlink_buf {
+	char			*data;
+	unsigned int		size;
+	unsigned int		len;		/* bytes in use */
+	unsigned int		count;		/* messages packed */
+	uint32_t		seq;		/* for the next message */
+	struct nlmsghdr		*cur;		/* message being built */
+};
+
+void libnetlink_buf_init(struct libnetlink_buf *b, void *data,
+			 unsigned int size, uint32_t seq);
+struct nlmsghdr *libnetlink_buf_msg(struct libnetlink_buf *b, int type,
+				    unsigned int flags);
+int libnetlink_buf_attr(struct libnetlink_buf *b, int type,
+			const void *data, int alen);
+struct nlattr *libnetlink_buf_nest_start(struct libnetlink_buf *b, int type);
+int libnetlink_buf_nest_end(struct libnetlink_buf *b, struct nlattr *nest);
+int libnetlink_buf_send(int fd, const struct libnetlink_buf *b);
+
+#define LIBNETLINK_TABLE_MAX	1024
+
+/* one parsed attribute, nested ones point back to their parent entry */
+struct libnetlink_attr_ent {
+	const struct nlattr	*attr;
+	unsigned short		type;
+	unsigned short		depth;
+	int			parent;		/* -1 at the top level */
+};
+
+struct libnetlink_attr_table {
+	unsigned int			count;
+	struct libnetlink_attr_ent	ent[LIBNETLINK_TABLE_MAX];
+};
+
+int libnetlink_parse_table(const struct nlmsghdr *nlh, int hdrlen,
+			   struct libnetlink_attr_table *tab, int maxdepth);
 
 #define NLA_ALIGNTO     4
 #define NLA_ALIGN(len)  (((len) + NLA_ALIGNTO - 1) & ~(NLA_ALIGNTO - 1))
 #define NLA_LENGTH(len) (NLA_ALIGN(sizeof(struct nlattr)) + (len))
 #define NLA_DATA(nfa)   ((void *)(((char *)(nfa)) + NLA_LENGTH(0)))
+#define NLA_OK(nfa, len) ((len) >= (int)sizeof(struct nlattr) && \
+			  (nfa)->nla_len >= sizeof(struct nlattr) && \
+			  (nfa)->nla_len <= (len))
+#define NLA_NEXT(nfa, len) ((len) -= NLA_ALIGN((nfa)->nla_len), \
+	(struct nlattr *)(((char *)(nfa)) + NLA_ALIGN((nfa)->nla_len)))
 
 #define NLMSG_TAIL(nlh) \
 (((void *) (nlh)) + NLMSG_ALIGN((nlh)->nlmsg_len))
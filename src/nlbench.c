@@ -13,47 +13,324 @@
 #include <linux/timer.h>
 #include <linux/netlink.h>
 #include <linux/random.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/sched/task.h>
+#include <linux/sched/signal.h>
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
 #include "nlbench.h"
 
-static struct sock *nlbench;
+/* messages a tasklet sends before yielding the softirq */
+#define NLBENCH_TASKLET_BUDGET	64
+/* finished jobs kept around so that their counters can be queried */
+#define NLBENCH_JOBS_KEEP	32
+
+/* every network namespace gets its own socket and counters */
+struct nlbench_net {
+	struct sock		*sk;
+	atomic64_t		sent;
+	atomic64_t		dropped;
+	atomic64_t		timeouts;
+	atomic64_t		blocked_ns;
+	/* blocking requests running, they all share sk_sndtimeo */
+	spinlock_t		block_lock;
+	unsigned int		block_users;
+	long			block_timeo;
+};
+
+static unsigned int nlbench_net_id;
+
+static inline struct nlbench_net *nlbench_pernet(struct net *net)
+{
+	return net_generic(net, nlbench_net_id);
+}
+
+static struct workqueue_struct *nlbench_wq;
+static struct workqueue_struct *nlbench_unbound_wq;
+
+static LIST_HEAD(nlbench_jobs);
+static DEFINE_MUTEX(nlbench_jobs_mutex);
+static u32 nlbench_job_id;
+static bool nlbench_exiting;
+
+static unsigned int nlbench_groups = NLBENCH_GRP_DEFAULT;
+module_param_named(groups, nlbench_groups, uint, 0444);
+MODULE_PARM_DESC(groups, "number of multicast groups to register");
 
 struct nlbench_obj {
 	struct timer_list	timeout;
+	struct nlbench_job	*job;
+};
+
+struct nlbench_shard_cfg {
+	u32			groups;
+	u32			policy;
+	u32			keys;
+};
+
+/* attrs == 0 means a plain payload of NLB_SIZE bytes */
+struct nlbench_shape {
+	u32			attrs;
+	u32			depth;
+	u32			attr_size;
+};
+
+enum nlbench_ctx {
+	NLBENCH_CTX_TIMER,
+	NLBENCH_CTX_TASKLET,
+	NLBENCH_CTX_WORK,
+	NLBENCH_CTX_KTHREAD,
+};
+
+/*
+ * Background request: either one armed timer per message or a single
+ * tasklet, work item or kthread producing messages until the job runs
+ * out of messages or time, or is cancelled.
+ */
+struct nlbench_job {
+	struct list_head	head;
+	struct nlbench_net	*nn;
+	u32			id;
+	int			type;
+	enum nlbench_ctx	ctx;
+	bool			mcast;
+	bool			stop;
+	bool			cancelled;
 	u32			msg_size;
 	u32			dst_pid;
+	u32			num_msgs;	/* 0 means until @end */
+	u32			done;
+	u32			rate;		/* 0 means unpaced */
+	long			timeo;
+	ktime_t			start;
+	ktime_t			end;		/* 0 means no deadline */
+	ktime_t			finish;
+	atomic_t		pending;	/* producers still running */
+	atomic64_t		sent;
+	atomic64_t		dropped;
+	struct nlbench_shard_cfg	shard;
+	struct nlbench_shape	shape;
+	struct nlbench_obj	*timers;
+	struct task_struct	*task;
+	union {
+		struct tasklet_struct	tasklet;
+		struct work_struct	work;
+	};
 };
 
-static struct sk_buff *nlbench_msg_alloc(int size, int type, gfp_t flags)
+static int nlbench_shard_parse(struct nlattr *cda[],
+			       struct nlbench_shard_cfg *shard)
+{
+	shard->groups = 1;
+	shard->policy = NLBENCH_SHARD_RR;
+	shard->keys = 0;
+
+	if (cda[NLB_GROUPS])
+		shard->groups = nla_get_u32(cda[NLB_GROUPS]);
+	if (shard->groups == 0 || shard->groups > nlbench_groups)
+		return -ERANGE;
+
+	if (cda[NLB_SHARD])
+		shard->policy = nla_get_u32(cda[NLB_SHARD]);
+	if (shard->policy > NLBENCH_SHARD_MAX)
+		return -EINVAL;
+
+	if (cda[NLB_KEYS])
+		shard->keys = nla_get_u32(cda[NLB_KEYS]);
+	if (shard->policy == NLBENCH_SHARD_KEY && shard->keys == 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* map the i-th message of a request to its destination group */
+static u32 nlbench_shard_group(const struct nlbench_shard_cfg *shard, u32 i)
+{
+	u32 slot;
+
+	if (shard->policy == NLBENCH_SHARD_KEY)
+		slot = hash_32(i % shard->keys, 32) % shard->groups;
+	else
+		slot = i % shard->groups;
+
+	return NLBENCH_GRP + slot;
+}
+
+static int nlbench_shape_parse(struct nlattr *cda[], struct nlbench_shape *shape)
+{
+	size_t len;
+
+	shape->attrs = 0;
+	shape->depth = 0;
+	shape->attr_size = 0;
+
+	if (!cda[NLB_ATTRS])
+		return 0;
+
+	shape->attrs = nla_get_u32(cda[NLB_ATTRS]);
+	if (cda[NLB_DEPTH])
+		shape->depth = nla_get_u32(cda[NLB_DEPTH]);
+	if (cda[NLB_ATTR_SIZE])
+		shape->attr_size = nla_get_u32(cda[NLB_ATTR_SIZE]);
+
+	if (shape->depth > NLBENCH_DEPTH_MAX)
+		return -ERANGE;
+	if (shape->attr_size > NLMSG_GOODSIZE)
+		return -E2BIG;
+
+	/* everything has to fit in the skb nlbench_msg_alloc() gets */
+	len = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nlbench_payload)) +
+	      (size_t)shape->attrs * nla_total_size(shape->attr_size) +
+	      shape->depth * nla_total_size(0);
+	if (len > NLMSG_GOODSIZE)
+		return -E2BIG;
+
+	return 0;
+}
+
+/* put the leaves of @level and then, recursively, the nests below it */
+static int nlbench_put_attrs(struct sk_buff *skb,
+			     const struct nlbench_shape *shape, u32 level)
+{
+	struct nlattr *attr, *nest;
+	u32 i;
+
+	for (i=level; i<shape->attrs; i+=shape->depth + 1) {
+		attr = nla_reserve(skb, NLBENCH_A_DATA, shape->attr_size);
+		if (attr == NULL)
+			return -EMSGSIZE;
+		memset(nla_data(attr), 0, shape->attr_size);
+	}
+	if (level == shape->depth)
+		return 0;
+
+	nest = nla_nest_start(skb, NLBENCH_A_NEST);
+	if (nest == NULL)
+		return -EMSGSIZE;
+	if (nlbench_put_attrs(skb, shape, level + 1) < 0)
+		return -EMSGSIZE;
+	nla_nest_end(skb, nest);
+
+	return 0;
+}
+
+static struct sk_buff *nlbench_msg_alloc(int size, int type,
+					 const struct nlbench_shape *shape,
+					 gfp_t flags)
 {
+	struct nlbench_payload *pl;
 	struct sk_buff *skb;
 	struct nlmsghdr *nlh;
-	char *data;
 
 	skb = alloc_skb(NLMSG_GOODSIZE, flags);
 	if (skb == NULL)
 		goto errout;
 
+	/* attribute-rich messages only carry the timestamp as header */
+	if (shape->attrs)
+		size = sizeof(struct nlbench_payload);
+
 	/* we reserve space for an empty payload */
 	nlh = nlmsg_put(skb, 0, 0, type, size, 0);
 	if (nlh == NULL)
 		goto errout_nlmsg;
 
-	data = nlmsg_data(nlh);
-	/* no payload data is currently added */
+	pl = nlmsg_data(nlh);
+	/* only the head is filled, the rest is padding */
+	if (size >= sizeof(pl->tstamp))
+		pl->tstamp = ktime_get_ns();
+	if (size >= sizeof(*pl)) {
+		pl->flags = shape->attrs ? NLBENCH_F_ATTRS : 0;
+		pl->pad = 0;
+	}
+	if (shape->attrs && nlbench_put_attrs(skb, shape, 0) < 0)
+		goto errout_nlmsg;
 	nlmsg_end(skb, nlh);
 
 	return skb;
 
 errout_nlmsg:
-	kfree(skb);
+	kfree_skb(skb);
 errout:
 	return NULL;
 }
 
-static int nlbench_ucast_pro_handler(struct nlattr *cda[])
+static void nlbench_account(struct nlbench_net *nn, int err)
+{
+	if (err < 0)
+		atomic64_inc(&nn->dropped);
+	else
+		atomic64_inc(&nn->sent);
+}
+
+/*
+ * netlink_unicast() reads its timeout from the sending socket, so the
+ * blocking requests of a namespace may only run together if they agree
+ * on it.
+ */
+static int nlbench_block_get(struct nlbench_net *nn, long timeo)
 {
 	int ret = 0;
+
+	spin_lock(&nn->block_lock);
+	if (nn->block_users && nn->block_timeo != timeo) {
+		ret = -EBUSY;
+	} else {
+		nn->block_users++;
+		nn->block_timeo = timeo;
+		WRITE_ONCE(nn->sk->sk_sndtimeo, timeo);
+	}
+	spin_unlock(&nn->block_lock);
+
+	return ret;
+}
+
+static void nlbench_block_put(struct nlbench_net *nn)
+{
+	spin_lock(&nn->block_lock);
+	nn->block_users--;
+	spin_unlock(&nn->block_lock);
+}
+
+/*
+ * Flow-controlled delivery: sleep until the receiver drains its queue or
+ * the timeout set by nlbench_block_get() expires. Only calls that really
+ * went to sleep count as blocked time.
+ */
+static int nlbench_unicast_block(struct nlbench_net *nn, struct sk_buff *skb,
+				 u32 dst_pid)
+{
+	unsigned long nvcsw = current->nvcsw;
+	ktime_t start;
+	int err;
+
+	start = ktime_get();
+	err = netlink_unicast(nn->sk, skb, dst_pid, 0);
+	if (current->nvcsw != nvcsw)
+		atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			     &nn->blocked_ns);
+	if (err == -EAGAIN)
+		atomic64_inc(&nn->timeouts);
+
+	return err;
+}
+
+static int nlbench_ucast_pro_handler(struct nlbench_net *nn,
+				     struct nlattr *cda[])
+{
+	int ret = 0, err;
 	u32 num_msgs, msg_size, dst_pid, i;
+	struct nlbench_shape shape;
+	long timeo = 0;
 
 	if (!cda[NLB_NUM] || !cda[NLB_SIZE] || !cda[NLB_PID])
 		return -EINVAL;
@@ -62,15 +339,28 @@ static int nlbench_ucast_pro_handler(struct nlattr *cda[])
 	if (msg_size < 0 || msg_size > NLMSG_GOODSIZE)
 		return -E2BIG;
 
+	ret = nlbench_shape_parse(cda, &shape);
+	if (ret < 0)
+		return ret;
+
 	num_msgs = nla_get_u32(cda[NLB_NUM]);
 	dst_pid = nla_get_u32(cda[NLB_PID]);
 
+	if (cda[NLB_TIMEOUT]) {
+		u32 msecs = nla_get_u32(cda[NLB_TIMEOUT]);
+
+		timeo = msecs ? msecs_to_jiffies(msecs) : MAX_SCHEDULE_TIMEOUT;
+		ret = nlbench_block_get(nn, timeo);
+		if (ret < 0)
+			return ret;
+	}
+
 	for (i=0; i<num_msgs; i++) {
 		struct sk_buff *skb;
 
 		skb = nlbench_msg_alloc(msg_size,
 					NLBENCH_MSG_UNICAST_PROCESS,
-					GFP_KERNEL);
+					&shape, GFP_KERNEL);
 		if (skb == NULL) {
 			/* continue but report to user-space that we
 			 * are losing message due to allocation failures,
@@ -78,137 +368,328 @@ static int nlbench_ucast_pro_handler(struct nlattr *cda[])
 			ret = -ENOMEM;
 			continue;
 		}
-		netlink_unicast(nlbench, skb, dst_pid, MSG_DONTWAIT);
+		if (timeo == 0) {
+			err = netlink_unicast(nn->sk, skb, dst_pid,
+					      MSG_DONTWAIT);
+		} else {
+			err = nlbench_unicast_block(nn, skb, dst_pid);
+			/* keep going, the receiver may catch up */
+			if (err == -EAGAIN && ret == 0)
+				ret = -ETIMEDOUT;
+		}
+		nlbench_account(nn, err);
+		/* a signal is the only way out of an endless wait */
+		if (err == -ERESTARTSYS || err == -EINTR) {
+			ret = -EINTR;
+			break;
+		}
 	}
+	if (timeo != 0)
+		nlbench_block_put(nn);
 	return ret;
 }
 
-static int nlbench_mcast_pro_handler(struct nlattr *cda[])
+static int nlbench_mcast_pro_handler(struct nlbench_net *nn,
+				     struct nlattr *cda[])
 {
 	int ret = 0;
-	u32 num_msgs, msg_size, i;
+	u32 num_msgs, msg_size, group, i;
+	struct nlbench_shard_cfg shard;
+	struct nlbench_shape shape;
 
 	if (!cda[NLB_NUM] || !cda[NLB_SIZE])
 		return -EINVAL;
 
+	/* netlink_broadcast() never waits for listeners */
+	if (cda[NLB_TIMEOUT])
+		return -EOPNOTSUPP;
+
 	msg_size = nla_get_u32(cda[NLB_SIZE]);
 	if (msg_size < 0 || msg_size > NLMSG_GOODSIZE)
 		return -E2BIG;
 
+	ret = nlbench_shard_parse(cda, &shard);
+	if (ret < 0)
+		return ret;
+
+	ret = nlbench_shape_parse(cda, &shape);
+	if (ret < 0)
+		return ret;
+
 	num_msgs = nla_get_u32(cda[NLB_NUM]);
 
 	for (i=0; i<num_msgs; i++) {
 		struct sk_buff *skb;
 
+		group = nlbench_shard_group(&shard, i);
+
 		skb = nlbench_msg_alloc(msg_size,
 					NLBENCH_MSG_MULTICAST_PROCESS,
-					GFP_KERNEL);
+					&shape, GFP_KERNEL);
 		if (skb == NULL) {
 			/* continue but report to user-space that we
 			 * are losing message due to allocation failures,
 			 * not because of netlink itself */
 			ret = -ENOMEM;
-			netlink_set_err(nlbench, 0, NLBENCH_GRP, -ENOBUFS);
+			netlink_set_err(nn->sk, 0, group, -ENOBUFS);
 			continue;
 		}
-		netlink_broadcast(nlbench, skb, 0, NLBENCH_GRP, GFP_KERNEL);
+		nlbench_account(nn, netlink_broadcast(nn->sk, skb, 0, group,
+						      GFP_KERNEL));
 	}
 	return ret;
 }
 
-static void nlbench_ucast(struct timer_list* foo)
+static void nlbench_job_account(struct nlbench_job *job, int err)
+{
+	nlbench_account(job->nn, err);
+	if (err < 0)
+		atomic64_inc(&job->dropped);
+	else
+		atomic64_inc(&job->sent);
+}
+
+static void nlbench_produce(struct nlbench_job *job, u32 i, gfp_t flags)
 {
-	struct nlbench_obj *obj = (struct nlbench_obj *) foo;
+	struct sock *sk = job->nn->sk;
 	struct sk_buff *skb;
+	u32 group;
 
-	skb = nlbench_msg_alloc(obj->msg_size,
-				NLBENCH_MSG_UNICAST_INTERRUPT,
-				GFP_ATOMIC);
-	if (skb == NULL)
-		goto errout;
+	skb = nlbench_msg_alloc(job->msg_size, job->type, &job->shape, flags);
+	if (job->mcast) {
+		group = nlbench_shard_group(&job->shard, i);
+		if (skb == NULL)
+			netlink_set_err(sk, 0, group, -ENOBUFS);
+		else
+			nlbench_job_account(job, netlink_broadcast(sk, skb,
+								   0, group,
+								   flags));
+	} else if (skb != NULL) {
+		if (job->timeo == 0)
+			nlbench_job_account(job, netlink_unicast(sk, skb,
+								 job->dst_pid,
+								 MSG_DONTWAIT));
+		else
+			nlbench_job_account(job,
+					    nlbench_unicast_block(job->nn, skb,
+								  job->dst_pid));
+	}
+}
 
-	kfree(obj);
-	netlink_unicast(nlbench, skb, obj->dst_pid, MSG_DONTWAIT);
-errout:
-	return;
+static bool nlbench_job_more(struct nlbench_job *job)
+{
+	if (READ_ONCE(job->stop))
+		return false;
+	if (job->num_msgs && job->done >= job->num_msgs)
+		return false;
+	if (job->end && ktime_after(ktime_get(), job->end))
+		return false;
+	return true;
 }
 
-static int nlbench_ucast_int_handler(struct nlattr *cda[])
+/* sleep until a rate-limited job is due to send its next message */
+static void nlbench_job_pace(struct nlbench_job *job)
 {
-	struct nlbench_obj *obj;
-	u32 delay, randomn, num_msgs, msg_size, dst_pid, i;
+	ktime_t due;
 
-	if (!cda[NLB_RANDOM] || !cda[NLB_NUM] ||
-	    !cda[NLB_SIZE] || !cda[NLB_PID])
-		return -EINVAL;
+	if (job->rate == 0)
+		return;
 
-	randomn = nla_get_u32(cda[NLB_RANDOM]);
+	due = ktime_add_ns(job->start,
+			   div_u64((u64)job->done * NSEC_PER_SEC, job->rate));
+	if (ktime_before(ktime_get(), due)) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&due, HRTIMER_MODE_ABS);
+	}
+}
 
-	msg_size = nla_get_u32(cda[NLB_SIZE]);
-	if (msg_size < 0 || msg_size > NLMSG_GOODSIZE)
-		return -E2BIG;
+static void nlbench_job_finish(struct nlbench_job *job)
+{
+	ktime_t now = ktime_get();
 
-	num_msgs = nla_get_u32(cda[NLB_NUM]);
-	dst_pid = nla_get_u32(cda[NLB_PID]);
+	if (atomic_dec_and_test(&job->pending)) {
+		WRITE_ONCE(job->finish, now);
+		if (job->timeo)
+			nlbench_block_put(job->nn);
+	}
+}
 
-	for (i=0; i<num_msgs; i++) {
-		obj = kzalloc(sizeof(struct nlbench_obj), GFP_KERNEL);
-		if (obj == NULL)
-			return -ENOMEM;
+static void nlbench_timer(struct timer_list *t)
+{
+	struct nlbench_obj *obj = from_timer(obj, t, timeout);
+	struct nlbench_job *job = obj->job;
 
-		/* use a random distribution to distribute timers */
-		if (randomn == 0)
-			delay = 0;
-		else
-			delay = prandom_u32() % (randomn * HZ);
+	if (!READ_ONCE(job->stop))
+		nlbench_produce(job, obj - job->timers, GFP_ATOMIC);
+	nlbench_job_finish(job);
+}
 
-		obj->msg_size = msg_size;
-		obj->dst_pid = dst_pid;
-		timer_setup(&obj->timeout, nlbench_ucast, 0);
-		obj->timeout.expires = jiffies + delay;
-		add_timer(&obj->timeout);
+static void nlbench_tasklet(struct tasklet_struct *t)
+{
+	struct nlbench_job *job = from_tasklet(job, t, tasklet);
+	u32 budget = NLBENCH_TASKLET_BUDGET;
+
+	while (budget-- && nlbench_job_more(job))
+		nlbench_produce(job, job->done++, GFP_ATOMIC);
+
+	if (nlbench_job_more(job))
+		tasklet_schedule(&job->tasklet);
+	else
+		nlbench_job_finish(job);
+}
+
+static void nlbench_work(struct work_struct *work)
+{
+	struct nlbench_job *job = container_of(work, struct nlbench_job, work);
+
+	while (nlbench_job_more(job)) {
+		nlbench_produce(job, job->done++, GFP_KERNEL);
+		cond_resched();
+		nlbench_job_pace(job);
+	}
+	nlbench_job_finish(job);
+}
+
+static int nlbench_kthread(void *data)
+{
+	struct nlbench_job *job = data;
+
+	/* nlbench_job_stop() interrupts sends blocked on a full receiver */
+	allow_signal(SIGINT);
+
+	while (!kthread_should_stop() && nlbench_job_more(job)) {
+		nlbench_produce(job, job->done++, GFP_KERNEL);
+		cond_resched();
+		nlbench_job_pace(job);
 	}
+	nlbench_job_finish(job);
 	return 0;
 }
 
-static void nlbench_mcast(struct timer_list * data)
+/*
+ * Stop every producer of @job and wait until none of them can run. A work
+ * item blocked on a full receiver is waited for until its send times out.
+ */
+static void nlbench_job_stop(struct nlbench_job *job)
 {
-	struct nlbench_obj *obj = (struct nlbench_obj *)data;
-	struct sk_buff *skb;
+	u32 i;
 
-	skb = nlbench_msg_alloc(obj->msg_size,
-				NLBENCH_MSG_MULTICAST_INTERRUPT,
-				GFP_ATOMIC);
-	if (skb == NULL)
-		goto errout;
+	WRITE_ONCE(job->stop, true);
 
-	kfree(obj);
-	netlink_broadcast(nlbench, skb, 0, NLBENCH_GRP, GFP_ATOMIC);
-	return;
-errout:
-	netlink_set_err(nlbench, 0, NLBENCH_GRP, -ENOBUFS);
+	switch(job->ctx) {
+	case NLBENCH_CTX_TIMER:
+		for (i=0; i<job->num_msgs; i++) {
+			if (del_timer_sync(&job->timers[i].timeout))
+				nlbench_job_finish(job);
+		}
+		break;
+	case NLBENCH_CTX_TASKLET:
+		tasklet_kill(&job->tasklet);
+		break;
+	case NLBENCH_CTX_WORK:
+		if (cancel_work_sync(&job->work))
+			nlbench_job_finish(job);
+		break;
+	case NLBENCH_CTX_KTHREAD:
+		/* kthread_stop() alone would not end a blocking send */
+		send_sig(SIGINT, job->task, 1);
+		/* -EINTR means the thread never got to run */
+		if (kthread_stop(job->task) == -EINTR)
+			nlbench_job_finish(job);
+		put_task_struct(job->task);
+		break;
+	}
 }
 
-static int nlbench_mcast_int_handler(struct nlattr *cda[])
+static void nlbench_job_free(struct nlbench_job *job)
 {
-	struct nlbench_obj *obj;
-	u32 delay, random_, num_msgs, msg_size, i;
+	kvfree(job->timers);
+	kfree(job);
+}
 
-	if (!cda[NLB_RANDOM] || !cda[NLB_NUM] || !cda[NLB_SIZE])
-		return -EINVAL;
+/* called with nlbench_jobs_mutex held */
+static void nlbench_jobs_reap(void)
+{
+	struct nlbench_job *job, *next;
+	unsigned int finished = 0;
 
-	random_ = nla_get_u32(cda[NLB_RANDOM]);
+	list_for_each_entry(job, &nlbench_jobs, head) {
+		if (atomic_read(&job->pending) == 0)
+			finished++;
+	}
 
-	msg_size = nla_get_u32(cda[NLB_SIZE]);
-	if (msg_size < 0 || msg_size > NLMSG_GOODSIZE)
-		return -E2BIG;
+	/* the list is kept in creation order, drop the oldest first */
+	list_for_each_entry_safe(job, next, &nlbench_jobs, head) {
+		if (finished <= NLBENCH_JOBS_KEEP)
+			break;
+		if (atomic_read(&job->pending) != 0)
+			continue;
+		list_del(&job->head);
+		nlbench_job_stop(job);
+		nlbench_job_free(job);
+		finished--;
+	}
+}
 
-	num_msgs = nla_get_u32(cda[NLB_NUM]);
+static int nlbench_job_reply(struct nlbench_job *job, u32 portid, u32 seq)
+{
+	struct nlmsghdr *rnlh;
+	struct sk_buff *rep;
+	ktime_t last;
+	u32 state;
 
-	for (i=0; i<num_msgs; i++) {
-		obj = kzalloc(sizeof(struct nlbench_obj), GFP_KERNEL);
-		if (obj == NULL)
-			return -ENOMEM;
+	rep = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (rep == NULL)
+		return -ENOMEM;
+
+	rnlh = nlmsg_put(rep, portid, seq, NLBENCH_MSG_JOB, 0, 0);
+	if (rnlh == NULL)
+		goto nla_put_failure;
+
+	last = READ_ONCE(job->finish);
+	if (atomic_read(&job->pending) != 0) {
+		state = NLBENCH_JOB_RUNNING;
+		last = ktime_get();
+	} else if (job->cancelled) {
+		state = NLBENCH_JOB_CANCELLED;
+	} else {
+		state = NLBENCH_JOB_DONE;
+	}
+	if (last == 0)
+		last = ktime_get();
+
+	if (nla_put_u32(rep, NLB_JOB_ID, job->id) ||
+	    nla_put_u32(rep, NLB_JOB_TYPE, job->type) ||
+	    nla_put_u32(rep, NLB_JOB_STATE, state) ||
+	    nla_put_u64_64bit(rep, NLB_JOB_SENT,
+			      atomic64_read(&job->sent), NLB_JOB_PAD) ||
+	    nla_put_u64_64bit(rep, NLB_JOB_DROPPED,
+			      atomic64_read(&job->dropped), NLB_JOB_PAD) ||
+	    nla_put_u64_64bit(rep, NLB_JOB_ELAPSED_NS,
+			      ktime_to_ns(ktime_sub(last, job->start)),
+			      NLB_JOB_PAD))
+		goto nla_put_failure;
+
+	nlmsg_end(rep, rnlh);
+	return nlmsg_unicast(job->nn->sk, rep, portid);
+
+nla_put_failure:
+	kfree_skb(rep);
+	return -EMSGSIZE;
+}
+
+static int nlbench_job_timers(struct nlbench_job *job, u32 random_)
+{
+	u32 delay, i;
+
+	job->timers = kvcalloc(job->num_msgs, sizeof(struct nlbench_obj),
+			       GFP_KERNEL);
+	if (job->timers == NULL)
+		return -ENOMEM;
+
+	atomic_set(&job->pending, job->num_msgs);
+	for (i=0; i<job->num_msgs; i++) {
+		struct nlbench_obj *obj = &job->timers[i];
 
 		/* use a random distribution to distribute timers */
 		if (random_ == 0)
@@ -216,30 +697,329 @@ static int nlbench_mcast_int_handler(struct nlattr *cda[])
 		else
 			delay = prandom_u32() % (random_ * HZ);
 
-		obj->msg_size = msg_size;
-		timer_setup(&obj->timeout, nlbench_mcast, 0);
+		obj->job = job;
+		timer_setup(&obj->timeout, nlbench_timer, 0);
 		obj->timeout.expires = jiffies + delay;
 		add_timer(&obj->timeout);
 	}
 	return 0;
 }
 
-static int nlbench_rcv_handle(const struct nlmsghdr *nlh, struct nlattr *cda[])
+static int nlbench_job_run(struct nlbench_job *job, int cpu, bool unbound)
+{
+	struct task_struct *task;
+
+	atomic_set(&job->pending, 1);
+
+	switch(job->ctx) {
+	case NLBENCH_CTX_TASKLET:
+		/* tasklets run on the CPU that schedules them */
+		tasklet_setup(&job->tasklet, nlbench_tasklet);
+		tasklet_schedule(&job->tasklet);
+		break;
+	case NLBENCH_CTX_WORK:
+		INIT_WORK(&job->work, nlbench_work);
+		if (unbound)
+			queue_work(nlbench_unbound_wq, &job->work);
+		else if (cpu >= 0)
+			queue_work_on(cpu, nlbench_wq, &job->work);
+		else
+			queue_work(nlbench_wq, &job->work);
+		break;
+	case NLBENCH_CTX_KTHREAD:
+		task = kthread_create(nlbench_kthread, job, "nlbench");
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		if (cpu >= 0)
+			kthread_bind(task, cpu);
+		/* process-mode jobs keep the default policy */
+		if (job->type != NLBENCH_MSG_UNICAST_PROCESS &&
+		    job->type != NLBENCH_MSG_MULTICAST_PROCESS)
+			sched_set_fifo(task);
+		job->task = get_task_struct(task);
+		wake_up_process(task);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int nlbench_job_handler(struct nlbench_net *nn, struct sk_buff *skb,
+			       const struct nlmsghdr *nlh, struct nlattr *cda[])
 {
+	struct nlbench_job *job;
+	int type = nlh->nlmsg_type, cpu = -1, ret;
+	u32 msg_size;
+
+	job = kzalloc(sizeof(struct nlbench_job), GFP_KERNEL);
+	if (job == NULL)
+		return -ENOMEM;
+
+	job->nn = nn;
+	job->type = type;
+	switch(type) {
+	case NLBENCH_MSG_UNICAST_INTERRUPT:
+	case NLBENCH_MSG_MULTICAST_INTERRUPT:
+		job->ctx = NLBENCH_CTX_TIMER;
+		break;
+	case NLBENCH_MSG_UNICAST_TASKLET:
+	case NLBENCH_MSG_MULTICAST_TASKLET:
+		job->ctx = NLBENCH_CTX_TASKLET;
+		break;
+	case NLBENCH_MSG_UNICAST_WORKQUEUE:
+	case NLBENCH_MSG_MULTICAST_WORKQUEUE:
+		job->ctx = NLBENCH_CTX_WORK;
+		break;
+	default:
+		job->ctx = NLBENCH_CTX_KTHREAD;
+		break;
+	}
+	job->mcast = (type == NLBENCH_MSG_MULTICAST_INTERRUPT ||
+		      type == NLBENCH_MSG_MULTICAST_PROCESS ||
+		      type == NLBENCH_MSG_MULTICAST_TASKLET ||
+		      type == NLBENCH_MSG_MULTICAST_WORKQUEUE ||
+		      type == NLBENCH_MSG_MULTICAST_KTHREAD);
+
+	ret = -EINVAL;
+	if (!cda[NLB_SIZE] || (!job->mcast && !cda[NLB_PID]))
+		goto errout;
+	if (!cda[NLB_NUM] && !cda[NLB_DURATION])
+		goto errout;
+	if (job->ctx == NLBENCH_CTX_TIMER &&
+	    (!cda[NLB_RANDOM] || !cda[NLB_NUM]))
+		goto errout;
+
+	ret = -E2BIG;
+	msg_size = nla_get_u32(cda[NLB_SIZE]);
+	if (msg_size > NLMSG_GOODSIZE)
+		goto errout;
+
+	ret = nlbench_shard_parse(cda, &job->shard);
+	if (ret < 0)
+		goto errout;
+
+	ret = nlbench_shape_parse(cda, &job->shape);
+	if (ret < 0)
+		goto errout;
+
+	if (cda[NLB_CPU]) {
+		ret = -EINVAL;
+		cpu = nla_get_u32(cda[NLB_CPU]);
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+			goto errout;
+	}
+
+	ret = -EOPNOTSUPP;
+	/* only the sleeping contexts can wait for a slow receiver */
+	if (cda[NLB_TIMEOUT]) {
+		u32 msecs = nla_get_u32(cda[NLB_TIMEOUT]);
+
+		if (job->mcast || job->ctx == NLBENCH_CTX_TIMER ||
+		    job->ctx == NLBENCH_CTX_TASKLET)
+			goto errout;
+		/* no signal reaches a work item, it could never be stopped */
+		if (msecs == 0 && job->ctx == NLBENCH_CTX_WORK)
+			goto errout;
+		job->timeo = msecs ? msecs_to_jiffies(msecs)
+				   : MAX_SCHEDULE_TIMEOUT;
+	}
+	/* timers are armed up front, tasklets cannot sleep between sends */
+	if (cda[NLB_RATE]) {
+		if (job->ctx == NLBENCH_CTX_TIMER ||
+		    job->ctx == NLBENCH_CTX_TASKLET)
+			goto errout;
+		job->rate = nla_get_u32(cda[NLB_RATE]);
+	}
+	if (cda[NLB_DURATION] && job->ctx == NLBENCH_CTX_TIMER)
+		goto errout;
+
+	job->msg_size = msg_size;
+	if (cda[NLB_NUM])
+		job->num_msgs = nla_get_u32(cda[NLB_NUM]);
+	if (cda[NLB_PID])
+		job->dst_pid = nla_get_u32(cda[NLB_PID]);
+
+	job->start = ktime_get();
+	if (cda[NLB_DURATION])
+		job->end = ktime_add_ns(job->start,
+				(u64)nla_get_u32(cda[NLB_DURATION]) *
+				NSEC_PER_SEC);
+
+	ret = -EINVAL;
+	if (job->num_msgs == 0 && job->end == 0)
+		goto errout;
+
+	mutex_lock(&nlbench_jobs_mutex);
+	if (nlbench_exiting) {
+		ret = -ESHUTDOWN;
+		goto errout_unlock;
+	}
+
+	if (job->timeo) {
+		ret = nlbench_block_get(nn, job->timeo);
+		if (ret < 0)
+			goto errout_unlock;
+	}
+
+	if (job->ctx == NLBENCH_CTX_TIMER)
+		ret = nlbench_job_timers(job, nla_get_u32(cda[NLB_RANDOM]));
+	else
+		ret = nlbench_job_run(job, cpu, cda[NLB_UNBOUND] != NULL);
+	if (ret < 0)
+		goto errout_block;
+
+	if (++nlbench_job_id == 0)
+		nlbench_job_id++;
+	job->id = nlbench_job_id;
+	list_add_tail(&job->head, &nlbench_jobs);
+	/* tell the requester which id to query or cancel */
+	nlbench_job_reply(job, NETLINK_CB(skb).portid, nlh->nlmsg_seq);
+	nlbench_jobs_reap();
+	mutex_unlock(&nlbench_jobs_mutex);
+
+	return 0;
+
+errout_block:
+	if (job->timeo)
+		nlbench_block_put(nn);
+errout_unlock:
+	mutex_unlock(&nlbench_jobs_mutex);
+errout:
+	kvfree(job->timers);
+	kfree(job);
+	return ret;
+}
+
+static int nlbench_job_get_handler(struct nlbench_net *nn,
+				   struct sk_buff *skb,
+				   const struct nlmsghdr *nlh,
+				   struct nlattr *cda[])
+{
+	u32 portid = NETLINK_CB(skb).portid;
+	struct nlbench_job *job;
+	int ret = cda[NLB_JOB] ? -ENOENT : 0;
+
+	mutex_lock(&nlbench_jobs_mutex);
+	list_for_each_entry(job, &nlbench_jobs, head) {
+		if (job->nn != nn)
+			continue;
+		if (cda[NLB_JOB] && job->id != nla_get_u32(cda[NLB_JOB]))
+			continue;
+		ret = nlbench_job_reply(job, portid, nlh->nlmsg_seq);
+		if (ret < 0)
+			break;
+	}
+	mutex_unlock(&nlbench_jobs_mutex);
+
+	return ret;
+}
+
+static int nlbench_job_cancel_handler(struct nlbench_net *nn,
+				      struct sk_buff *skb,
+				      const struct nlmsghdr *nlh,
+				      struct nlattr *cda[])
+{
+	struct nlbench_job *job, *found = NULL;
+
+	if (!cda[NLB_JOB])
+		return -EINVAL;
+
+	mutex_lock(&nlbench_jobs_mutex);
+	list_for_each_entry(job, &nlbench_jobs, head) {
+		if (job->nn == nn && job->id == nla_get_u32(cda[NLB_JOB])) {
+			found = job;
+			list_del(&job->head);
+			break;
+		}
+	}
+	mutex_unlock(&nlbench_jobs_mutex);
+
+	if (found == NULL)
+		return -ENOENT;
+
+	found->cancelled = atomic_read(&found->pending) != 0;
+	nlbench_job_stop(found);
+	nlbench_job_reply(found, NETLINK_CB(skb).portid, nlh->nlmsg_seq);
+	nlbench_job_free(found);
+
+	return 0;
+}
+static int nlbench_stats_handler(struct nlbench_net *nn, struct sk_buff *skb,
+				 const struct nlmsghdr *nlh)
+{
+	u32 portid = NETLINK_CB(skb).portid;
+	struct nlmsghdr *rnlh;
+	struct sk_buff *rep;
+
+	rep = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (rep == NULL)
+		return -ENOMEM;
+
+	rnlh = nlmsg_put(rep, portid, nlh->nlmsg_seq, NLBENCH_MSG_STATS, 0, 0);
+	if (rnlh == NULL)
+		goto nla_put_failure;
+
+	if (nla_put_u64_64bit(rep, NLB_STATS_SENT,
+			      atomic64_read(&nn->sent),
+			      NLB_STATS_PAD) ||
+	    nla_put_u64_64bit(rep, NLB_STATS_DROPPED,
+			      atomic64_read(&nn->dropped),
+			      NLB_STATS_PAD) ||
+	    nla_put_u64_64bit(rep, NLB_STATS_TIMEOUTS,
+			      atomic64_read(&nn->timeouts),
+			      NLB_STATS_PAD) ||
+	    nla_put_u64_64bit(rep, NLB_STATS_BLOCKED_NS,
+			      atomic64_read(&nn->blocked_ns),
+			      NLB_STATS_PAD))
+		goto nla_put_failure;
+
+	nlmsg_end(rep, rnlh);
+	return nlmsg_unicast(nn->sk, rep, portid);
+
+nla_put_failure:
+	kfree_skb(rep);
+	return -EMSGSIZE;
+}
+
+static int nlbench_rcv_handle(struct sk_buff *skb, const struct nlmsghdr *nlh,
+			      struct nlattr *cda[])
+{
+	struct nlbench_net *nn = nlbench_pernet(sock_net(skb->sk));
 	int ret = -EOPNOTSUPP;
 
 	switch(nlh->nlmsg_type) {
-		case NLBENCH_MSG_MULTICAST_INTERRUPT:
-			ret = nlbench_mcast_int_handler(cda);
+		case NLBENCH_MSG_MULTICAST_PROCESS:
+			/* timed runs move to the background */
+			if (cda[NLB_DURATION])
+				ret = nlbench_job_handler(nn, skb, nlh, cda);
+			else
+				ret = nlbench_mcast_pro_handler(nn, cda);
 			break;
+		case NLBENCH_MSG_UNICAST_PROCESS:
+			if (cda[NLB_DURATION])
+				ret = nlbench_job_handler(nn, skb, nlh, cda);
+			else
+				ret = nlbench_ucast_pro_handler(nn, cda);
+			break;
+		case NLBENCH_MSG_STATS:
+			ret = nlbench_stats_handler(nn, skb, nlh);
+			break;
+		case NLBENCH_MSG_MULTICAST_INTERRUPT:
 		case NLBENCH_MSG_UNICAST_INTERRUPT:
-			ret = nlbench_ucast_int_handler(cda);
+		case NLBENCH_MSG_UNICAST_TASKLET:
+		case NLBENCH_MSG_MULTICAST_TASKLET:
+		case NLBENCH_MSG_UNICAST_WORKQUEUE:
+		case NLBENCH_MSG_MULTICAST_WORKQUEUE:
+		case NLBENCH_MSG_UNICAST_KTHREAD:
+		case NLBENCH_MSG_MULTICAST_KTHREAD:
+			ret = nlbench_job_handler(nn, skb, nlh, cda);
 			break;
-		case NLBENCH_MSG_MULTICAST_PROCESS:
-			ret = nlbench_mcast_pro_handler(cda);
+		case NLBENCH_MSG_JOB:
+			ret = nlbench_job_get_handler(nn, skb, nlh, cda);
 			break;
-		case NLBENCH_MSG_UNICAST_PROCESS:
-			ret = nlbench_ucast_pro_handler(cda);
+		case NLBENCH_MSG_JOB_CANCEL:
+			ret = nlbench_job_cancel_handler(nn, skb, nlh, cda);
 			break;
 	}
 	return ret;
@@ -266,7 +1046,7 @@ static int nlbench_rcv_msg(struct sk_buff *skb, struct nlmsghdr *nlh, struct net
 			return err;
 	}
 
-	return nlbench_rcv_handle(nlh, cda);
+	return nlbench_rcv_handle(skb, nlh, cda);
 }
 
 static void
@@ -275,24 +1055,94 @@ nlbench_rcv(struct sk_buff *skb)
 	netlink_rcv_skb(skb, &nlbench_rcv_msg);
 }
 
-static int __init nlbench_init(void)
+static int __net_init nlbench_net_init(struct net *net)
 {
+	struct nlbench_net *nn = nlbench_pernet(net);
 	struct netlink_kernel_cfg cfg = {
     	.input = nlbench_rcv,
+	.groups = nlbench_groups,
 	};
-	nlbench = netlink_kernel_create(&init_net, NETLINK_BENCHMARK, &cfg);
-	if (nlbench == NULL) {
+
+	spin_lock_init(&nn->block_lock);
+	nn->sk = netlink_kernel_create(net, NETLINK_BENCHMARK, &cfg);
+	if (nn->sk == NULL) {
 		printk("netlinkbech: cannot create netlink socket.\n");
 		return -ENOMEM;
 	}
+	return 0;
+}
+
+static void __net_exit nlbench_net_exit(struct net *net)
+{
+	struct nlbench_net *nn = nlbench_pernet(net);
+	struct nlbench_job *job, *next;
+
+	/* producers must be gone before their socket is */
+	mutex_lock(&nlbench_jobs_mutex);
+	list_for_each_entry_safe(job, next, &nlbench_jobs, head) {
+		if (job->nn != nn)
+			continue;
+		list_del(&job->head);
+		nlbench_job_stop(job);
+		nlbench_job_free(job);
+	}
+	mutex_unlock(&nlbench_jobs_mutex);
+
+	netlink_kernel_release(nn->sk);
+}
+
+static struct pernet_operations nlbench_net_ops = {
+	.init	= nlbench_net_init,
+	.exit	= nlbench_net_exit,
+	.id	= &nlbench_net_id,
+	.size	= sizeof(struct nlbench_net),
+};
+
+static int __init nlbench_init(void)
+{
+	int ret;
+
+	if (nlbench_groups == 0) {
+		printk("netlinkbench: at least one group is required.\n");
+		return -EINVAL;
+	}
+
+	ret = -ENOMEM;
+	nlbench_wq = alloc_workqueue("nlbench", 0, 0);
+	if (nlbench_wq == NULL)
+		goto errout;
+
+	nlbench_unbound_wq = alloc_workqueue("nlbench_unbound", WQ_UNBOUND, 0);
+	if (nlbench_unbound_wq == NULL)
+		goto errout_wq;
+
+	ret = register_pernet_subsys(&nlbench_net_ops);
+	if (ret < 0)
+		goto errout_unbound_wq;
+
 	printk("netlinkbech loaded.\n");
 	return 0;
+
+errout_unbound_wq:
+	destroy_workqueue(nlbench_unbound_wq);
+errout_wq:
+	destroy_workqueue(nlbench_wq);
+errout:
+	return ret;
 }
 
 static void __exit nlbench_exit(void)
 {
 	printk("netlinkbench: removing module.\n");
-	netlink_kernel_release(nlbench);
+
+	mutex_lock(&nlbench_jobs_mutex);
+	nlbench_exiting = true;
+	mutex_unlock(&nlbench_jobs_mutex);
+
+	/* stops the jobs of every namespace, then releases its socket */
+	unregister_pernet_subsys(&nlbench_net_ops);
+	destroy_workqueue(nlbench_unbound_wq);
+	destroy_workqueue(nlbench_wq);
 }
 
 module_init(nlbench_init);
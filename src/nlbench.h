@@ -1,6 +1,8 @@
 #ifndef _NLBENCH_H_
 #define _NLBENCH_H_
 
+#include <linux/types.h>
+
 #ifndef NETLINK_BENCHMARK
 #define NETLINK_BENCHMARK 25
 #endif
@@ -11,6 +13,15 @@ enum nlbench_msg_types {
 	NLBENCH_MSG_UNICAST_INTERRUPT,
 	NLBENCH_MSG_MULTICAST_PROCESS,
 	NLBENCH_MSG_MULTICAST_INTERRUPT,
+	NLBENCH_MSG_STATS,
+	NLBENCH_MSG_UNICAST_TASKLET,
+	NLBENCH_MSG_MULTICAST_TASKLET,
+	NLBENCH_MSG_UNICAST_WORKQUEUE,
+	NLBENCH_MSG_MULTICAST_WORKQUEUE,
+	NLBENCH_MSG_UNICAST_KTHREAD,
+	NLBENCH_MSG_MULTICAST_KTHREAD,
+	NLBENCH_MSG_JOB,
+	NLBENCH_MSG_JOB_CANCEL,
 	NLBENCH_MSG_MAX
 };
 
@@ -20,13 +31,88 @@ enum nlbench_attr {
 	NLB_NUM,		/* number of messages */
 	NLB_RANDOM,		/* size of random distribution (in secs) */
 	NLB_PID,		/* destination port id for unicast */
+	NLB_GROUPS,		/* number of groups to shard multicast across */
+	NLB_SHARD,		/* sharding policy, see enum nlbench_shard */
+	NLB_KEYS,		/* number of distinct keys for key sharding */
+	NLB_TIMEOUT,		/* block up to this many msecs (0 = forever) */
+	NLB_CPU,		/* CPU to run the workqueue/kthread producer on */
+	NLB_UNBOUND,		/* flag: use the unbound workqueue */
+	NLB_DURATION,		/* run the job for this many secs */
+	NLB_RATE,		/* messages per second (0 = as fast as possible) */
+	NLB_JOB,		/* job id to query or cancel */
+	NLB_ATTRS,		/* emit this many attributes instead of padding */
+	NLB_DEPTH,		/* nesting levels the attributes are spread on */
+	NLB_ATTR_SIZE,		/* bytes of data in every attribute */
 	__NLB_MAX
 };
 #define NLB_MAX			(__NLB_MAX - 1)
 
+enum nlbench_stats_attr {
+	NLB_STATS_UNSPEC,
+	NLB_STATS_PAD,
+	NLB_STATS_SENT,		/* messages accepted by netlink */
+	NLB_STATS_DROPPED,	/* messages netlink refused to deliver */
+	NLB_STATS_TIMEOUTS,	/* blocking sends that timed out */
+	NLB_STATS_BLOCKED_NS,	/* time blocking sends slept on receivers */
+	__NLB_STATS_MAX
+};
+#define NLB_STATS_MAX		(__NLB_STATS_MAX - 1)
+
+enum nlbench_job_attr {
+	NLB_JOB_UNSPEC,
+	NLB_JOB_PAD,
+	NLB_JOB_ID,
+	NLB_JOB_TYPE,		/* message type that started the job */
+	NLB_JOB_STATE,		/* see enum nlbench_job_state */
+	NLB_JOB_SENT,
+	NLB_JOB_DROPPED,
+	NLB_JOB_ELAPSED_NS,
+	__NLB_JOB_MAX
+};
+#define NLB_JOB_MAX		(__NLB_JOB_MAX - 1)
+
+enum nlbench_job_state {
+	NLBENCH_JOB_RUNNING,
+	NLBENCH_JOB_DONE,
+	NLBENCH_JOB_CANCELLED,
+};
+
+enum nlbench_shard {
+	NLBENCH_SHARD_RR,	/* spread messages round-robin */
+	NLBENCH_SHARD_KEY,	/* same key always goes to the same group */
+	__NLBENCH_SHARD_MAX
+};
+#define NLBENCH_SHARD_MAX	(__NLBENCH_SHARD_MAX - 1)
+
+/* head of every message payload, as much of it as the payload holds */
+struct nlbench_payload {
+	__u64	tstamp;		/* CLOCK_MONOTONIC nsecs at build time */
+	__u32	flags;		/* NLBENCH_F_* */
+	__u32	pad;
+};
+
+#define NLBENCH_F_ATTRS		0x1	/* attributes follow, see below */
+
+/*
+ * Attribute-rich payloads: struct nlbench_payload with NLBENCH_F_ATTRS
+ * set, followed by NLB_ATTRS
+ * NLBENCH_A_DATA attributes spread round-robin over NLB_DEPTH + 1 levels,
+ * each level below the top one wrapped in a NLBENCH_A_NEST attribute.
+ */
+enum nlbench_data_attr {
+	NLBENCH_A_UNSPEC,
+	NLBENCH_A_DATA,
+	NLBENCH_A_NEST,
+	__NLBENCH_A_MAX
+};
+#define NLBENCH_A_MAX		(__NLBENCH_A_MAX - 1)
+#define NLBENCH_DEPTH_MAX	16
+
 #define NLBENCH_GRP_NONE	0
 #define NLBENCH_GRP		1
-#define __NLBENCH_GRP_MAX	NLBENCH_GRP
+#define NLBENCH_GRP_DEFAULT	32	/* groups registered by the module */
+/* highest group with the default registration, groups= may move it */
+#define __NLBENCH_GRP_MAX	(NLBENCH_GRP + NLBENCH_GRP_DEFAULT)
 #define NLBENCH_GRP_MAX		(__NLBENCH_GRP_MAX - 1)
 
 #endif
@@ -29,7 +29,8 @@ static void usage(char *prog)
 int main(int argc, char *argv[])
 {
 	int fd, i, bytes, args[3];
-	struct nlmsghdr *nlh;
+	struct libnetlink_buf req;
+	char reqbuf[NLMSG_HDRLEN];
 	char buf[128];
 	int c, unit = NETLINK_BENCHMARK;
 
@@ -51,11 +52,8 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	nlh = libnetlink_newmsg(NLMSG_NOOP, 0, 0);
-	if (nlh == NULL) {
-		perror("calloc");
-		exit(EXIT_FAILURE);
-	}
+	libnetlink_buf_init(&req, reqbuf, sizeof(reqbuf), 0);
+	libnetlink_buf_msg(&req, NLMSG_NOOP, 0);
 
 	printf("sending netlink NOOP\n");
 
@@ -64,7 +62,7 @@ int main(int argc, char *argv[])
 again:
 	gettimeofday(&start, NULL);
 
-	if (libnetlink_send(fd, nlh) < 0) {
+	if (libnetlink_buf_send(fd, &req) < 0) {
 		perror("send");
 		exit(EXIT_FAILURE);
 	}
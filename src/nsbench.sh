@@ -0,0 +1,140 @@
+#!/bin/bash
+#
+# Namespace scaling benchmark for netlinkbench.
+#
+# For every namespace count N, creates N network namespaces, starts one
+# nlbenchrecv in each and then a timed nlbenchsend job per namespace, all
+# in parallel. Every job's rate is its own sent count over its own run
+# time, so jobs that start late are not cut short. Reports the aggregate
+# msgs/s and how evenly they were spread (Jain's fairness index, 1.0
+# means perfectly fair).
+#
+# Timed process-mode jobs run in a kthread under the normal scheduler.
+# The other kthread producers are SCHED_FIFO and, unpaced, starve each
+# other and the receivers once there are more namespaces than CPUs.
+#
+# Needs root and the nlbench module loaded.
+#
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+COUNTS="1 2 4 8 16"
+TYPE=multicast-process
+SIZE=0
+SECS=10
+RATE=0
+OUT=$(mktemp -d /tmp/nsbench.XXXXXX)
+PREFIX=nlbench
+
+usage()
+{
+	echo "Usage: $0 [options]"
+	echo "-n	namespace counts to try (default \"$COUNTS\")"
+	echo "-t	nlbenchsend type (default $TYPE)"
+	echo "-s	size of messages (in bytes)"
+	echo "-d	duration of each run (in secs)"
+	echo "-R	messages per second per namespace (default unpaced)"
+	echo "-h	show this help"
+}
+
+cleanup()
+{
+	for ns in $(ip netns list | awk '{print $1}' | grep "^$PREFIX"); do
+		ip netns pids "$ns" | xargs -r kill 2>/dev/null
+		ip netns del "$ns"
+	done
+}
+
+run()
+{
+	local n=$1 i pid pids="" dst job line
+
+	for i in $(seq 1 "$n"); do
+		if ! ip netns add "$PREFIX$i"; then
+			cleanup
+			return 1
+		fi
+	done
+
+	# receivers only keep the jobs company, cleanup stops them
+	for i in $(seq 1 "$n"); do
+		ip netns exec "$PREFIX$i" "$DIR/nlbenchrecv" > /dev/null &
+		eval "recv_$i=$!"
+	done
+	sleep 1
+
+	# nlbenchsend returns as soon as its job is started
+	for i in $(seq 1 "$n"); do
+		dst=""
+		case $TYPE in
+		unicast-*)
+			# 'ip netns exec' execs in place, its pid is the port id
+			eval "pid=\$recv_$i"
+			dst="-p $pid"
+			;;
+		esac
+		ip netns exec "$PREFIX$i" "$DIR/nlbenchsend" -t "$TYPE" \
+			-s "$SIZE" -d "$SECS" -R "$RATE" $dst \
+			> "$OUT/send.$n.$i" &
+		pids="$pids $!"
+	done
+	wait $pids
+
+	sleep "$SECS"
+	for i in $(seq 1 "$n"); do
+		job=$(sed -n 's/^job=\([0-9]*\) .*/\1/p' "$OUT/send.$n.$i")
+		if [ -z "$job" ]; then
+			echo "no job started in $PREFIX$i:" >&2
+			cat "$OUT/send.$n.$i" >&2
+			cleanup
+			return 1
+		fi
+		while :; do
+			line=$(ip netns exec "$PREFIX$i" "$DIR/nlbenchsend" \
+				-t job -j "$job" | grep "^job=")
+			case $line in
+			*state=running*) sleep 1 ;;
+			*) break ;;
+			esac
+		done
+		if [ -z "$line" ]; then
+			echo "job $job of $PREFIX$i is gone" >&2
+			cleanup
+			return 1
+		fi
+		echo "$line" > "$OUT/job.$n.$i"
+	done
+	cleanup
+
+	for i in $(seq 1 "$n"); do
+		sed -n 's/.* rate=\([0-9]*\) .*/\1/p' "$OUT/job.$n.$i"
+	done | awk -v n="$n" '
+		{ sum += $1; sq += $1 * $1;
+		  if (NR == 1 || $1 < min) min = $1;
+		  if ($1 > max) max = $1 }
+		END {
+			printf "%10d\t%12.0f\t%12.0f\t%12.0f\t%8.4f\n", n,
+				sum, min, max,
+				sq > 0 ? sum * sum / (n * sq) : 0
+		}'
+}
+
+while getopts "n:t:s:d:R:h" opt; do
+	case $opt in
+	n) COUNTS=$OPTARG ;;
+	t) TYPE=$OPTARG ;;
+	s) SIZE=$OPTARG ;;
+	d) SECS=$OPTARG ;;
+	R) RATE=$OPTARG ;;
+	h) usage; exit 0 ;;
+	*) usage; exit 1 ;;
+	esac
+done
+
+trap 'cleanup; exit 1' INT TERM
+cleanup
+
+echo "# type=$TYPE size=$SIZE secs=$SECS rate=$RATE output=$OUT"
+echo "# namespaces	    msgs/s	 min_ns_msg/s	 max_ns_msg/s	fairness"
+for n in $COUNTS; do
+	run "$n" || exit 1
+done
@@ -0,0 +1,215 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Description: perf_event_open counters for netlinkbench
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+static const struct {
+	uint32_t	type;
+	uint64_t	config;
+} perf_events[PERF_MAX] = {
+	[PERF_CYCLES]		= { PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]	= { PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CACHE_MISSES]	= { PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_TASK_CLOCK]	= { PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_TASK_CLOCK },
+	[PERF_CTX_SWITCHES]	= { PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* hardware counters are read as one group through the cycles leader */
+struct perf_group {
+	uint64_t	nr;
+	uint64_t	time_enabled;
+	uint64_t	time_running;
+	uint64_t	values[PERF_CACHE_MISSES + 1];
+};
+
+static int
+perf_open_one(int counter, pid_t pid, int cpu, int kernel, int group_fd)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= perf_events[counter].type,
+		.config		= perf_events[counter].config,
+		.exclude_kernel	= !kernel,
+		.exclude_hv	= 1,
+	};
+
+	/* per-CPU counting wants the CPU clock, not a task one */
+	if (pid == -1 && counter == PERF_TASK_CLOCK)
+		attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	if (counter == PERF_CYCLES)
+		attr.read_format = PERF_FORMAT_GROUP |
+				   PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(__NR_perf_event_open, &attr, pid, cpu, group_fd, 0);
+}
+
+static int
+perf_open_all(struct perf_counters *p, pid_t pid, int cpu)
+{
+	int i;
+
+	for (i = 0; i < PERF_MAX; i++)
+		p->fd[i] = -1;
+
+	p->hw = 1;
+	for (i = 0; i < PERF_MAX; i++) {
+		int group = -1;
+
+		if (perf_events[i].type == PERF_TYPE_HARDWARE && !p->hw)
+			continue;
+
+		/* a group is scheduled as a whole, IPC stays consistent */
+		if (perf_events[i].type == PERF_TYPE_HARDWARE &&
+		    i != PERF_CYCLES)
+			group = p->fd[PERF_CYCLES];
+
+		p->fd[i] = perf_open_one(i, pid, cpu, p->kernel, group);
+		if (p->fd[i] >= 0)
+			continue;
+
+		/* no PMU, fall back to the software counters only */
+		if (perf_events[i].type == PERF_TYPE_HARDWARE &&
+		    errno != EACCES && errno != EPERM) {
+			p->hw = 0;
+			continue;
+		}
+		perf_close(p);
+		return -1;
+	}
+	if (!p->hw) {
+		for (i = 0; i < PERF_MAX; i++) {
+			if (perf_events[i].type != PERF_TYPE_HARDWARE ||
+			    p->fd[i] < 0)
+				continue;
+			close(p->fd[i]);
+			p->fd[i] = -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Count @pid (0 is the calling thread) on any CPU, or everything that runs
+ * on @cpu if @pid is -1. Most of the work is done in the kernel, so try to
+ * count it first and only settle for user time if perf_event_paranoid
+ * does not allow it.
+ */
+int
+perf_open(struct perf_counters *p, pid_t pid, int cpu)
+{
+	p->kernel = 1;
+	if (perf_open_all(p, pid, cpu) == 0)
+		return 0;
+	if (errno != EACCES && errno != EPERM)
+		return -1;
+
+	p->kernel = 0;
+	return perf_open_all(p, pid, cpu);
+}
+
+void
+perf_close(struct perf_counters *p)
+{
+	int i;
+
+	for (i = 0; i < PERF_MAX; i++) {
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+}
+
+/*
+ * read(2) is async-signal-safe, this may be called from a handler. The
+ * hardware group is scaled up to the whole time it was enabled in case
+ * the PMU had to multiplex it with other users.
+ */
+void
+perf_read(const struct perf_counters *p, uint64_t val[PERF_MAX])
+{
+	struct perf_group grp;
+	int i;
+
+	for (i = 0; i < PERF_MAX; i++) {
+		val[i] = 0;
+		if (perf_events[i].type == PERF_TYPE_HARDWARE || p->fd[i] < 0)
+			continue;
+		if (read(p->fd[i], &val[i], sizeof(uint64_t)) != sizeof(uint64_t))
+			val[i] = 0;
+	}
+	if (!p->hw)
+		return;
+
+	if (read(p->fd[PERF_CYCLES], &grp, sizeof(grp)) != sizeof(grp) ||
+	    grp.nr != PERF_CACHE_MISSES + 1 || grp.time_running == 0)
+		return;
+
+	for (i = PERF_CYCLES; i <= PERF_CACHE_MISSES; i++)
+		val[i] = (double)grp.values[i] * grp.time_enabled /
+			 grp.time_running;
+}
+
+int
+perf_header(const struct perf_counters *p, char *buf)
+{
+	return sprintf(buf, "%s\tcpu_ns/msg\tcsw/s",
+		       p->hw ? "\tcycles/msg\tipc\tmisses/msg" : "");
+}
+
+int
+perf_format(const struct perf_counters *p, const uint64_t delta[PERF_MAX],
+	    uint64_t msgs, double secs, char *buf)
+{
+	int len = 0;
+
+	if (p->hw)
+		len += sprintf(buf, "\t%10.1f\t%10.2f\t%10.2f",
+			       msgs ? (double)delta[PERF_CYCLES] / msgs : 0,
+			       delta[PERF_CYCLES] ?
+			       (double)delta[PERF_INSTRUCTIONS] /
+			       delta[PERF_CYCLES] : 0,
+			       msgs ? (double)delta[PERF_CACHE_MISSES] / msgs : 0);
+	len += sprintf(buf + len, "\t%10.1f\t%10.0f",
+		       msgs ? (double)delta[PERF_TASK_CLOCK] / msgs : 0,
+		       secs > 0 ? delta[PERF_CTX_SWITCHES] / secs : 0);
+	return len;
+}
+
+int
+perf_summary(const struct perf_counters *p, const uint64_t delta[PERF_MAX],
+	     uint64_t msgs, char *buf)
+{
+	int len = 0;
+
+	if (p->hw)
+		len += sprintf(buf, "cycles_per_msg=%.1f ipc=%.2f "
+			       "cache_misses_per_msg=%.2f ",
+			       msgs ? (double)delta[PERF_CYCLES] / msgs : 0,
+			       delta[PERF_CYCLES] ?
+			       (double)delta[PERF_INSTRUCTIONS] /
+			       delta[PERF_CYCLES] : 0,
+			       msgs ? (double)delta[PERF_CACHE_MISSES] / msgs : 0);
+	len += sprintf(buf + len, "cpu_ns_per_msg=%.1f ctx_switches=%llu",
+		       msgs ? (double)delta[PERF_TASK_CLOCK] / msgs : 0,
+		       (unsigned long long)delta[PERF_CTX_SWITCHES]);
+	return len;
+}
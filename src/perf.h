@@ -0,0 +1,38 @@
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_TASK_CLOCK,	/* nanoseconds on the CPU */
+	PERF_CTX_SWITCHES,
+	PERF_MAX
+};
+
+/*
+ * Counters of one thread (or CPU). Without hardware counters, e.g. in
+ * most VMs, only the software ones are open and hw is zero.
+ */
+struct perf_counters {
+	int		fd[PERF_MAX];
+	int		hw;
+	int		kernel;		/* kernel time is counted too */
+};
+
+int perf_open(struct perf_counters *p, pid_t pid, int cpu);
+void perf_close(struct perf_counters *p);
+void perf_read(const struct perf_counters *p, uint64_t val[PERF_MAX]);
+
+/* tab separated columns, for the interval reports */
+int perf_header(const struct perf_counters *p, char *buf);
+int perf_format(const struct perf_counters *p, const uint64_t delta[PERF_MAX],
+		uint64_t msgs, double secs, char *buf);
+/* "name=value" pairs, for the summaries */
+int perf_summary(const struct perf_counters *p,
+		 const uint64_t delta[PERF_MAX], uint64_t msgs, char *buf);
+
+#endif
@@ -17,14 +17,34 @@
 #include <signal.h>
 #include <sched.h>
 #include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <linux/sock_diag.h>
 
 #include "lib.h"
 #include "nlbench.h"
+#include "perf.h"
+
+/* NLMSG_GOODSIZE, the largest message the module builds, is below this */
+#define RECV_BUFLEN	8192
 
 static unsigned int events, cur_events;
 static unsigned int enobufs, cur_enobufs;
 static unsigned int errors, cur_errors;
 static int lines, iterations, max_iterations = ~0U;
+static int latency;
+static uint64_t lat_sum, lat_samples, lat_max;
+static uint64_t cur_lat_sum, cur_lat_samples, cur_lat_max;
+static int parse;
+static uint64_t parse_ns, parse_msgs;
+static uint64_t cur_parse_ns, cur_parse_msgs, cur_parse_attrs;
+static struct libnetlink_attr_table table;
+static unsigned int truncated;
+static int sockfd, meminfo = 1;
+static uint32_t last_drops;
+static int counters;
+static struct perf_counters perf;
+static uint64_t perf_start[PERF_MAX], perf_last[PERF_MAX];
 FILE *ofd;
 
 static void usage(char *prog)
@@ -32,34 +52,197 @@ static void usage(char *prog)
 	printf("Usage: %s [options]\n", prog);
 	printf("-b\tbuffer size\n");
 	printf("-s\tscheduler (\"rr\", \"fifo\")\n");
+	printf("-p\tpriority (if \"rr\" or \"fifo\" is used, default is "
+		"the highest)\n");
 	printf("-n\tnice value (if normal scheduling is used)\n");
 	printf("-u\tnetlink socket unit (default is netlink_benchmark)\n");
- 	printf("-g\tnetlink group (default is NLBENCH_GRP)\n");
+ 	printf("-g\tnetlink groups, e.g. \"1,3,5-8\" (default is NLBENCH_GRP)\n");
 	printf("-c\tCPU affinity (starting by zero)\n");
 	printf("-i\titerations\n");
 	printf("-f\tfile to store the output\n");
+	printf("-l\treport kernel-to-userspace latency\n");
+	printf("-P\tvalidate and index the attributes of attribute-rich "
+		"messages\n");
+	printf("-z\tdiscard payloads, only copy the headers\n");
+	printf("-B\tbusy-poll, spin on a nonblocking recv instead of "
+		"sleeping\n");
+	printf("-e\treport CPU counters (cycles, IPC, cache misses) "
+		"per message\n");
 	printf("-h\tshow this help\n");
 }
 
+/* subscribe to every group in a list such as "1,3,5-8" */
+static int join_groups(int fd, char *list)
+{
+	char *tok, *save;
+	unsigned int first, last, grp;
+
+	for (tok = strtok_r(list, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (sscanf(tok, "%u-%u", &first, &last) != 2)
+			last = first = atoi(tok);
+		if (first == 0 || last < first) {
+			fprintf(stderr, "Bad group range `%s'\n", tok);
+			errno = EINVAL;
+			return -1;
+		}
+		for (grp = first; grp <= last; grp++) {
+			if (libnetlink_add_membership(fd, grp) < 0)
+				return -1;
+			printf("# listening to group %u\n", grp);
+		}
+	}
+	return 0;
+}
+
+/* account the delay between the kernel building a message and now */
+static void account_latency(const void *data, int len)
+{
+	const struct nlmsghdr *nlh = data;
+	const struct nlbench_payload *pl = NLMSG_DATA(nlh);
+	struct timespec now;
+	uint64_t delta;
+
+	if (len < NLMSG_LENGTH(sizeof(pl->tstamp)) ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(pl->tstamp)) ||
+	    nlh->nlmsg_type <= NLBENCH_MSG_BASE)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	delta = now.tv_sec * 1000000000ULL + now.tv_nsec - pl->tstamp;
+
+	lat_sum += delta;
+	lat_samples++;
+	if (delta > lat_max)
+		lat_max = delta;
+	cur_lat_sum += delta;
+	cur_lat_samples++;
+	if (delta > cur_lat_max)
+		cur_lat_max = delta;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The parse stage a real listener runs on every message it gets. Plain
+ * payloads are padding the module never writes, they are skipped.
+ */
+static int parse_msg(const void *data, int len)
+{
+	const struct nlmsghdr *nlh = data;
+	const struct nlbench_payload *pl = NLMSG_DATA(nlh);
+	uint64_t start;
+	int ret;
+
+	if (len < NLMSG_HDRLEN || nlh->nlmsg_len > len)
+		return -1;
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*pl)) ||
+	    !(pl->flags & NLBENCH_F_ATTRS))
+		return 0;
+
+	start = now_ns();
+	ret = libnetlink_parse_table(nlh, sizeof(struct nlbench_payload),
+				     &table, NLBENCH_DEPTH_MAX);
+	if (ret < 0)
+		return -1;
+
+	start = now_ns() - start;
+	parse_ns += start;
+	parse_msgs++;
+	cur_parse_ns += start;
+	cur_parse_msgs++;
+	cur_parse_attrs += ret;
+	return 0;
+}
+
 static void sigint_handler(int foo)
 {
-	char buf[128];
+	char buf[256];
 
-	sprintf(buf, "# total_events=%u total_enobufs=%u\n", events, enobufs);
+	sprintf(buf, "# total_events=%u total_enobufs=%u total_truncated=%u\n",
+		events, enobufs, truncated);
 	printf("%s", buf);
-	if (ofd != NULL) {
+	if (ofd != NULL)
 		fputs(buf, ofd);
-		fclose(ofd);
+
+	if (latency) {
+		/* messages too small for a timestamp give no samples */
+		if (lat_samples == 0)
+			sprintf(buf, "# avg_latency_us=n/a "
+				"max_latency_us=n/a\n");
+		else
+			sprintf(buf, "# avg_latency_us=%.3f "
+				"max_latency_us=%.3f\n",
+				(double)lat_sum / lat_samples / 1000,
+				(double)lat_max / 1000);
+		printf("%s", buf);
+		if (ofd != NULL)
+			fputs(buf, ofd);
 	}
+	if (parse) {
+		sprintf(buf, "# avg_parse_ns=%.1f\n", parse_msgs ?
+			(double)parse_ns / parse_msgs : 0);
+		printf("%s", buf);
+		if (ofd != NULL)
+			fputs(buf, ofd);
+	}
+	if (counters) {
+		uint64_t val[PERF_MAX];
+		int i, len;
+
+		perf_read(&perf, val);
+		for (i = 0; i < PERF_MAX; i++)
+			val[i] -= perf_start[i];
+		len = sprintf(buf, "# ");
+		len += perf_summary(&perf, val, events, buf + len);
+		sprintf(buf + len, "\n");
+		printf("%s", buf);
+		if (ofd != NULL)
+			fputs(buf, ofd);
+	}
+	if (ofd != NULL)
+		fclose(ofd);
 	exit(EXIT_FAILURE);
 }
 
+/* receive queue fill (in %) and drops since the last call */
+static int sample_meminfo(double *fill, uint32_t *drops)
+{
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0 ||
+	    len < sizeof(mem))
+		return -1;
+
+	*fill = mem[SK_MEMINFO_RCVBUF] ?
+		100.0 * mem[SK_MEMINFO_RMEM_ALLOC] / mem[SK_MEMINFO_RCVBUF] : 0;
+	*drops = mem[SK_MEMINFO_DROPS] - last_drops;
+	last_drops = mem[SK_MEMINFO_DROPS];
+	return 0;
+}
+
 static void handler(int foo)
 {
-	char buf[128];
+	char buf[256];
+	uint32_t drops;
+	double fill;
+	int len;
 
 	if (lines % 22 == 0) {
-		sprintf(buf, "# events/s\tenobufs/s\terrors/s\n");
+		len = sprintf(buf, "# events/s\tenobufs/s\terrors/s%s%s%s",
+			      meminfo ? "\trq_fill%\tdrops/s" : "",
+			      latency ? "\tavg_lat_us\tmax_lat_us" : "",
+			      parse ? "\tparse_ns/msg\tattrs/msg" : "");
+		if (counters)
+			len += perf_header(&perf, buf + len);
+		sprintf(buf + len, "\n");
 		printf("%s", buf);
 		if (ofd != NULL)
 			fputs(buf, ofd);
@@ -67,12 +250,46 @@ static void handler(int foo)
 
 	lines++;
 	alarm(1);
-	sprintf(buf, "%10u\t%10u\t%10u\n", cur_events, cur_enobufs, cur_errors);
+	len = sprintf(buf, "%10u\t%10u\t%10u",
+		      cur_events, cur_enobufs, cur_errors);
+	if (meminfo) {
+		if (sample_meminfo(&fill, &drops) == 0)
+			len += sprintf(buf + len, "\t%10.1f\t%10u",
+				       fill, drops);
+		else
+			len += sprintf(buf + len, "\t%10s\t%10s", "-", "-");
+	}
+	if (latency && cur_lat_samples == 0)
+		len += sprintf(buf + len, "\t%10s\t%10s", "-", "-");
+	else if (latency)
+		len += sprintf(buf + len, "\t%10.3f\t%10.3f",
+			       (double)cur_lat_sum / cur_lat_samples / 1000,
+			       (double)cur_lat_max / 1000);
+	if (parse)
+		len += sprintf(buf + len, "\t%10.1f\t%10.1f",
+			       cur_parse_msgs ?
+			       (double)cur_parse_ns / cur_parse_msgs : 0,
+			       cur_parse_msgs ?
+			       (double)cur_parse_attrs / cur_parse_msgs : 0);
+	if (counters) {
+		uint64_t val[PERF_MAX], delta[PERF_MAX];
+		int i;
+
+		perf_read(&perf, val);
+		for (i = 0; i < PERF_MAX; i++) {
+			delta[i] = val[i] - perf_last[i];
+			perf_last[i] = val[i];
+		}
+		len += perf_format(&perf, delta, cur_events, 1, buf + len);
+	}
+	sprintf(buf + len, "\n");
 	printf("%s", buf);
 	if (ofd != NULL)
 		fputs(buf, ofd);
 
 	cur_events = cur_enobufs = cur_errors = 0;
+	cur_lat_sum = cur_lat_samples = cur_lat_max = 0;
+	cur_parse_ns = cur_parse_msgs = cur_parse_attrs = 0;
 
 	if (max_iterations != ~0U && ++iterations == max_iterations)
 		sigint_handler(0);
@@ -80,18 +297,21 @@ static void handler(int foo)
 
 int main(int argc, char *argv[])
 {
-	int fd;
+	int fd, buflen = RECV_BUFLEN, discard = 0;
 	int sched = 0, buffersize = 0, niceval = 0, cpuaffinity = -1;
-	int unit = NETLINK_BENCHMARK, group = NLBENCH_GRP;
-	char buf[4096];
-	char c, *file;
+	int prio = -1, busypoll = 0;
+	int unit = NETLINK_BENCHMARK;
+	char *buf;
+	char c, *file, *groups = NULL, defgroup[16];
+	uint32_t drops;
+	double fill;
 
 	printf("# pid=%u\n", getpid());
 
 	signal(SIGINT, sigint_handler);
 	signal(SIGTERM, sigint_handler);
 
-	while((c = getopt(argc, argv, "b:s:n:hu:g:c:i:f:")) != EOF) {
+	while((c = getopt(argc, argv, "b:s:n:p:hu:g:c:i:f:lPzeB")) != EOF) {
 		switch(c) {
 		case 'b':
 			buffersize = atoi(optarg);
@@ -112,13 +332,15 @@ int main(int argc, char *argv[])
 		case 'n':
 			niceval = atoi(optarg);
 			break;
+		case 'p':
+			prio = atoi(optarg);
+			break;
 		case 'u':
 			unit = atoi(optarg);
 			printf("# listening to netlink unit %d\n", unit);
 			break;
 		case 'g':
-			group = atoi(optarg);
-			printf("# listening to group %d\n", group);
+			groups = optarg;
 			break;
 		case 'c':
 			cpuaffinity = atoi(optarg);
@@ -129,22 +351,59 @@ int main(int argc, char *argv[])
 		case 'f':
 			ofd = fopen(optarg, "w");
 			break;
+		case 'l':
+			latency = 1;
+			break;
+		case 'P':
+			parse = 1;
+			break;
+		case 'z':
+			discard = 1;
+			break;
+		case 'e':
+			counters = 1;
+			break;
+		case 'B':
+			busypoll = 1;
+			printf("# busy-polling\n");
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(EXIT_SUCCESS);
 		}
 	}
 
+	if (discard && parse) {
+		fprintf(stderr, "ERROR: cannot parse discarded payloads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * In discard mode only the header and the timestamp are copied,
+	 * MSG_TRUNC still dequeues the whole message.
+	 */
+	if (discard) {
+		buflen = NLMSG_LENGTH(sizeof(struct nlbench_payload));
+		printf("# discarding payloads\n");
+	}
+	buf = malloc(buflen);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
 	if (sched != SCHED_OTHER) {
 		struct sched_param schedparam = {
-			.sched_priority = sched_get_priority_max(sched),
+			.sched_priority = prio >= 0 ?
+				prio : sched_get_priority_max(sched),
 		};
 
 		if (sched_setscheduler(0, sched, &schedparam) == -1) {
 			perror("sched");
 			exit(EXIT_FAILURE);
 		}
-	} else if (nice) {
+		printf("# using priority %d\n", schedparam.sched_priority);
+	} else if (niceval) {
 		printf("# setting nice to %d\n", niceval);
 		nice(niceval);
 	}
@@ -163,12 +422,21 @@ int main(int argc, char *argv[])
 		printf("# setting CPU affinity to `%d'\n", cpuaffinity);
 	}
 
-	fd = libnetlink_create_socket(unit, group);
+	fd = libnetlink_create_socket(unit, 0);
 	if (fd < 0) {
 		perror("socket");
 		exit(EXIT_FAILURE);
 	}
 
+	if (groups == NULL) {
+		snprintf(defgroup, sizeof(defgroup), "%d", NLBENCH_GRP);
+		groups = defgroup;
+	}
+	if (join_groups(fd, groups) < 0) {
+		perror("setsockopt");
+		exit(EXIT_FAILURE);
+	}
+
 	if (buffersize > 0) {
 		socklen_t socklen;
 		int ret;
@@ -183,11 +451,56 @@ int main(int argc, char *argv[])
 		printf("# using buffer size: %d\n", buffersize);
 	}
 
+	/* prime the drop counter, older kernels have no SO_MEMINFO */
+	sockfd = fd;
+	if (sample_meminfo(&fill, &drops) < 0)
+		meminfo = 0;
+
+	/* this thread runs the receive loop, count it alone */
+	if (counters) {
+		if (perf_open(&perf, 0, -1) < 0) {
+			perror("perf_event_open");
+			exit(EXIT_FAILURE);
+		}
+		printf("# counting %s events%s\n",
+		       perf.hw ? "hardware" : "software",
+		       perf.kernel ? "" : " (user space only)");
+		perf_read(&perf, perf_start);
+		memcpy(perf_last, perf_start, sizeof(perf_last));
+	}
+
 	signal(SIGALRM, handler);
 	alarm(1);
 
 	while (1) {
-		if (libnetlink_recv(fd, buf, sizeof(buf)) < 0) {
+		int ret;
+
+		ret = libnetlink_recv_flags(fd, buf, buflen, MSG_TRUNC |
+					    (busypoll ? MSG_DONTWAIT : 0));
+		/* nothing queued yet, go round again without sleeping */
+		if (ret < 0 && busypoll && errno == EAGAIN)
+			continue;
+		if (ret > buflen && !discard) {
+			char *nbuf;
+
+			/* the tail is lost, make room for the next one */
+			truncated++;
+			errors++;
+			cur_errors++;
+			nbuf = realloc(buf, ret);
+			if (nbuf != NULL) {
+				printf("# growing buffer to %d bytes\n", ret);
+				buf = nbuf;
+				buflen = ret;
+			}
+			events++;
+			cur_events++;
+			continue;
+		}
+		if (ret > buflen)
+			ret = buflen;
+
+		if (ret < 0) {
 			if (errno == ENOBUFS) {
 				enobufs++;
 				cur_enobufs++;
@@ -195,6 +508,14 @@ int main(int argc, char *argv[])
 			}
 			errors++;
 			cur_errors++;
+		} else {
+			if (latency)
+				account_latency(buf, ret);
+			/* a message that fails validation counts as an error */
+			if (parse && parse_msg(buf, ret) < 0) {
+				errors++;
+				cur_errors++;
+			}
 		}
 		events++;
 		cur_events++;
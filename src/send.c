@@ -17,30 +17,243 @@
 #include <signal.h>
 #include <sched.h>
 #include <getopt.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "lib.h"
 #include "nlbench.h"
+#include "perf.h"
+
+static const struct {
+	const char	*name;
+	int		type;
+} msg_types[] = {
+	{ "unicast-interrupt",		NLBENCH_MSG_UNICAST_INTERRUPT },
+	{ "multicast-interrupt",	NLBENCH_MSG_MULTICAST_INTERRUPT },
+	{ "unicast-process",		NLBENCH_MSG_UNICAST_PROCESS },
+	{ "multicast-process",		NLBENCH_MSG_MULTICAST_PROCESS },
+	{ "unicast-tasklet",		NLBENCH_MSG_UNICAST_TASKLET },
+	{ "multicast-tasklet",		NLBENCH_MSG_MULTICAST_TASKLET },
+	{ "unicast-workqueue",		NLBENCH_MSG_UNICAST_WORKQUEUE },
+	{ "multicast-workqueue",	NLBENCH_MSG_MULTICAST_WORKQUEUE },
+	{ "unicast-kthread",		NLBENCH_MSG_UNICAST_KTHREAD },
+	{ "multicast-kthread",		NLBENCH_MSG_MULTICAST_KTHREAD },
+	{ "stats",			NLBENCH_MSG_STATS },
+	{ "job",			NLBENCH_MSG_JOB },
+	{ "cancel",			NLBENCH_MSG_JOB_CANCEL },
+	{ NULL },
+};
+
+static const char *job_states[] = {
+	[NLBENCH_JOB_RUNNING]	= "running",
+	[NLBENCH_JOB_DONE]	= "done",
+	[NLBENCH_JOB_CANCELLED]	= "cancelled",
+};
+
+static const char *stats_names[NLB_STATS_MAX + 1] = {
+	[NLB_STATS_SENT]	= "sent",
+	[NLB_STATS_DROPPED]	= "dropped",
+	[NLB_STATS_TIMEOUTS]	= "timeouts",
+	[NLB_STATS_BLOCKED_NS]	= "blocked_ns",
+};
 
 static void usage(char *prog)
 {
 	printf("%s [options]\n", prog);
-	printf("-t\ttype (\"[uni|multi]cast-[process|interrupt]\")\n");
+	printf("-t\ttype (\"[uni|multi]cast-[process|interrupt|tasklet|"
+	       "workqueue|kthread]\",\n\t\"stats\", \"job\", \"cancel\")\n");
 	printf("-n\tnumber of messages\n");
 	printf("-s\tsize of messages (in bytes)\n");
 	printf("-r\trandom distribution (in secs)\n");
 	printf("-c\tCPU affinity (starting by zero)\n");
 	printf("-p\tPort ID (only for unicast)\n");
+	printf("-g\tnumber of groups to shard multicast across\n");
+	printf("-k\tnumber of keys (shard by key instead of round-robin)\n");
+	printf("-T\tblock up to msecs if the receiver is full (0 = forever,\n"
+	       "\tonly for unicast process/workqueue/kthread, not 0 for\n"
+	       "\tworkqueue; blocking requests running together must use\n"
+	       "\tthe same timeout)\n");
+	printf("-P\tCPU to run the workqueue/kthread producer on\n");
+	printf("-u\tuse the unbound workqueue\n");
+	printf("-d\trun in the background for this many secs\n");
+	printf("-R\tsend at most this many messages per second\n");
+	printf("-j\tjob id (for \"job\" and \"cancel\")\n");
+	printf("-a\tnumber of attributes per message (instead of padding)\n");
+	printf("-D\tnesting depth of the attributes\n");
+	printf("-A\tsize of every attribute (in bytes)\n");
+	printf("-B\tpack this many requests into one sendmsg\n");
+	printf("-e\treport CPU counters (cycles, IPC, cache misses) per "
+		"message,\n\tof this thread or, with -P and -d, of the "
+		"CPU a workqueue\n\tor kthread producer is bound to\n");
 	printf("-h\tshow this help\n");
 }
 
+struct job_status {
+	uint32_t	id;
+	uint32_t	state;
+	uint64_t	sent;
+	uint64_t	dropped;
+	uint64_t	elapsed;	/* nanoseconds */
+};
+
+static void parse_job(const struct nlmsghdr *nlh, struct job_status *js)
+{
+	struct nlattr *tb[NLB_JOB_MAX + 1];
+
+	memset(js, 0, sizeof(*js));
+	js->state = NLBENCH_JOB_RUNNING;
+	if (libnetlink_parse(nlh, tb, NLB_JOB_MAX) < 0)
+		return;
+
+	if (tb[NLB_JOB_ID])
+		memcpy(&js->id, NLA_DATA(tb[NLB_JOB_ID]), sizeof(js->id));
+	if (tb[NLB_JOB_STATE])
+		memcpy(&js->state, NLA_DATA(tb[NLB_JOB_STATE]),
+		       sizeof(js->state));
+	if (tb[NLB_JOB_SENT])
+		memcpy(&js->sent, NLA_DATA(tb[NLB_JOB_SENT]),
+		       sizeof(js->sent));
+	if (tb[NLB_JOB_DROPPED])
+		memcpy(&js->dropped, NLA_DATA(tb[NLB_JOB_DROPPED]),
+		       sizeof(js->dropped));
+	if (tb[NLB_JOB_ELAPSED_NS])
+		memcpy(&js->elapsed, NLA_DATA(tb[NLB_JOB_ELAPSED_NS]),
+		       sizeof(js->elapsed));
+}
+
+static void print_job(const struct job_status *js)
+{
+	double secs = js->elapsed / 1e9;
+
+	printf("job=%u state=%s sent=%llu dropped=%llu elapsed=%.3f secs "
+	       "rate=%.0f msgs/s\n", js->id,
+	       js->state <= NLBENCH_JOB_CANCELLED ?
+	       job_states[js->state] : "?",
+	       (unsigned long long)js->sent, (unsigned long long)js->dropped,
+	       secs, secs > 0 ? js->sent / secs : 0);
+}
+
+/*
+ * Wait for the ACK, printing any job status sent ahead of it. The last
+ * one is also stored in @js unless that is NULL.
+ */
+static int recv_ack(int fd, struct job_status *js)
+{
+	char buf[1024];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nlmsgerr *err = NLMSG_DATA(nlh);
+	struct job_status cur;
+
+	while (1) {
+		if (libnetlink_recv(fd, buf, sizeof(buf)) < 0)
+			return -errno;
+
+		if (nlh->nlmsg_type == NLMSG_ERROR)
+			return err->error;
+
+		if (nlh->nlmsg_type == NLBENCH_MSG_JOB) {
+			parse_job(nlh, &cur);
+			print_job(&cur);
+			if (js != NULL)
+				*js = cur;
+		}
+	}
+}
+
+/* poll a timed job until it is over, @js then holds its final figures */
+static int wait_job(int fd, struct job_status *js)
+{
+	char buf[1024];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct libnetlink_buf req;
+	int id = js->id;
+
+	/* no job status came with the ACK, an id of 0 would list them all */
+	if (id == 0)
+		return -ENOENT;
+
+	while (js->state == NLBENCH_JOB_RUNNING) {
+		usleep(10000);
+		libnetlink_buf_init(&req, buf, sizeof(buf), time(NULL));
+		if (libnetlink_buf_msg(&req, NLBENCH_MSG_JOB, 0) == NULL ||
+		    libnetlink_buf_attr(&req, NLB_JOB, &id, sizeof(int)) < 0 ||
+		    libnetlink_buf_send(fd, &req) < 0)
+			return -errno;
+
+		if (libnetlink_recv(fd, buf, sizeof(buf)) < 0)
+			return -errno;
+		if (nlh->nlmsg_type == NLMSG_ERROR)
+			return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+		if (nlh->nlmsg_type != NLBENCH_MSG_JOB)
+			return -EPROTO;
+		parse_job(nlh, js);
+
+		if (libnetlink_recv(fd, buf, sizeof(buf)) < 0)
+			return -errno;
+	}
+	return 0;
+}
+
+static int query_stats(int fd, uint64_t stats[])
+{
+	char buf[1024];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nlattr *tb[NLB_STATS_MAX + 1];
+	struct libnetlink_buf req;
+	int i;
+
+	libnetlink_buf_init(&req, buf, sizeof(buf), time(NULL));
+	if (libnetlink_buf_msg(&req, NLBENCH_MSG_STATS, 0) == NULL ||
+	    libnetlink_buf_send(fd, &req) < 0)
+		return -errno;
+
+	if (libnetlink_recv(fd, buf, sizeof(buf)) < 0)
+		return -errno;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR)
+		return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+
+	if (nlh->nlmsg_type != NLBENCH_MSG_STATS ||
+	    libnetlink_parse(nlh, tb, NLB_STATS_MAX) < 0)
+		return -EPROTO;
+
+	for (i = 0; i <= NLB_STATS_MAX; i++) {
+		stats[i] = 0;
+		if (tb[i] != NULL)
+			memcpy(&stats[i], NLA_DATA(tb[i]), sizeof(uint64_t));
+	}
+	return recv_ack(fd, NULL);
+}
+
+static void print_stats(const uint64_t stats[])
+{
+	int i;
+
+	for (i = 0; i <= NLB_STATS_MAX; i++) {
+		if (stats_names[i] != NULL)
+			printf("%s=%llu ", stats_names[i],
+				(unsigned long long)stats[i]);
+	}
+	printf("\n");
+}
+
 int main(int argc, char *argv[])
 {
-	int fd, i, bytes, args[4], flags = 0, cpuaffinity = -1;
-	int type = 0;
-	struct nlmsghdr *nlh;
-	char buf[128], c;
+	int fd, i, bytes, args[4] = {}, flags = 0, cpuaffinity = -1;
+	int type = 0, groups = 1, keys = 0, shard, timeout = -1, ret;
+	int prodcpu = -1, unbound = 0, duration = 0, rate = 0, job = 0;
+	int attrs = 0, depth = 0, attrsize = 4, batch = 1, counters = 0;
+	uint64_t perf_before[PERF_MAX], perf_after[PERF_MAX];
+	struct perf_counters perf;
+	uint64_t before[NLB_STATS_MAX + 1], after[NLB_STATS_MAX + 1];
+	struct timeval start, stop;
+	struct libnetlink_buf req;
+	struct job_status js = {};
+	char reqbuf[16384];
+	char c;
 
-	while((c = getopt(argc, argv, "t:n:s:r:c:p:h")) != EOF) {
+	while((c = getopt(argc, argv, "t:n:s:r:c:p:g:k:T:P:ud:R:j:a:D:A:B:eh")) != EOF) {
 	switch(c) {
 	case 'n':
 		args[0] = atoi(optarg);
@@ -59,21 +272,59 @@ int main(int argc, char *argv[])
 		flags |= (1 << 3);
 		break;
 	case 't':
-		if (strncmp("unicast-interrupt", optarg, strlen(optarg)) == 0) {
-			type = NLBENCH_MSG_UNICAST_INTERRUPT;
-		} else if (strncmp("multicast-interrupt",
-			   optarg, strlen(optarg)) == 0) {
-			type = NLBENCH_MSG_MULTICAST_INTERRUPT;
-		} else if (strncmp("unicast-process",
-			   optarg, strlen(optarg)) == 0) {
-			type = NLBENCH_MSG_UNICAST_PROCESS;
-		} else if (strncmp("multicast-process",
-			   optarg, strlen(optarg)) == 0) {
-			type = NLBENCH_MSG_MULTICAST_PROCESS;
-		} else {
+		for (i = 0; msg_types[i].name != NULL; i++) {
+			if (strncmp(msg_types[i].name, optarg,
+				    strlen(optarg)) == 0)
+				break;
+		}
+		if (msg_types[i].name == NULL) {
 			printf("unknown type `%s'\n", optarg);
 			exit(EXIT_FAILURE);
 		}
+		type = msg_types[i].type;
+		break;
+	case 'g':
+		groups = atoi(optarg);
+		break;
+	case 'k':
+		keys = atoi(optarg);
+		break;
+	case 'T':
+		timeout = atoi(optarg);
+		break;
+	case 'P':
+		prodcpu = atoi(optarg);
+		break;
+	case 'u':
+		unbound = 1;
+		break;
+	case 'd':
+		duration = atoi(optarg);
+		break;
+	case 'R':
+		rate = atoi(optarg);
+		break;
+	case 'j':
+		job = atoi(optarg);
+		break;
+	case 'a':
+		attrs = atoi(optarg);
+		break;
+	case 'D':
+		depth = atoi(optarg);
+		break;
+	case 'A':
+		attrsize = atoi(optarg);
+		break;
+	case 'e':
+		counters = 1;
+		break;
+	case 'B':
+		batch = atoi(optarg);
+		if (batch < 1) {
+			fprintf(stderr, "ERROR: batch must be at least 1\n");
+			exit(EXIT_FAILURE);
+		}
 		break;
 	case 'c':
 		cpuaffinity = atoi(optarg);
@@ -88,17 +339,100 @@ int main(int argc, char *argv[])
 		usage(argv[0]);
 		exit(EXIT_FAILURE);
 	}
+
+	if (type == NLBENCH_MSG_STATS) {
+		fd = libnetlink_create_socket(NETLINK_BENCHMARK, 0);
+		if (fd < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+		ret = query_stats(fd, after);
+		if (ret < 0) {
+			printf("Error: %s\n", strerror(-ret));
+			exit(EXIT_FAILURE);
+		}
+		print_stats(after);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (type == NLBENCH_MSG_JOB || type == NLBENCH_MSG_JOB_CANCEL) {
+		fd = libnetlink_create_socket(NETLINK_BENCHMARK, 0);
+		if (fd < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+		libnetlink_buf_init(&req, reqbuf, sizeof(reqbuf), time(NULL));
+		libnetlink_buf_msg(&req, type, 0);
+		/* without an id, "job" lists every job */
+		if (job > 0)
+			libnetlink_buf_attr(&req, NLB_JOB, &job, sizeof(int));
+		if (libnetlink_buf_send(fd, &req) < 0) {
+			perror("send");
+			exit(EXIT_FAILURE);
+		}
+		ret = recv_ack(fd, NULL);
+		if (ret < 0) {
+			printf("Error: %s\n", strerror(-ret));
+			exit(EXIT_FAILURE);
+		}
+		exit(EXIT_SUCCESS);
+	}
+
+	/* a timed run needs no message count, 0 means until it expires */
+	if (duration > 0)
+		flags |= (1 << 0);
+
 	if ((type == NLBENCH_MSG_UNICAST_INTERRUPT && flags != 0xf) ||
 	    (type == NLBENCH_MSG_MULTICAST_INTERRUPT && flags != 0x7) ||
 	    (type == NLBENCH_MSG_UNICAST_PROCESS && flags != 0xb) ||
-	    (type == NLBENCH_MSG_MULTICAST_PROCESS && flags != 0x3)) {
+	    (type == NLBENCH_MSG_MULTICAST_PROCESS && flags != 0x3) ||
+	    ((type == NLBENCH_MSG_UNICAST_TASKLET ||
+	      type == NLBENCH_MSG_UNICAST_WORKQUEUE ||
+	      type == NLBENCH_MSG_UNICAST_KTHREAD) && (flags & 0xb) != 0xb) ||
+	    ((type == NLBENCH_MSG_MULTICAST_TASKLET ||
+	      type == NLBENCH_MSG_MULTICAST_WORKQUEUE ||
+	      type == NLBENCH_MSG_MULTICAST_KTHREAD) && (flags & 0x3) != 0x3)) {
 		fprintf(stderr, "ERROR: wrong option combination!\n");
 		usage(argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
+	/*
+	 * Synchronous process-mode requests produce from this very thread.
+	 * Everything else runs elsewhere, it can only be caught on the CPU
+	 * it is bound to, for as long as the run lasts. Timers, tasklets and
+	 * the unbound workqueue ignore -P, they cannot be caught at all.
+	 */
+	if (counters) {
+		int process = type == NLBENCH_MSG_UNICAST_PROCESS ||
+			      type == NLBENCH_MSG_MULTICAST_PROCESS;
+		int bound = process ||
+			    type == NLBENCH_MSG_UNICAST_KTHREAD ||
+			    type == NLBENCH_MSG_MULTICAST_KTHREAD ||
+			    ((type == NLBENCH_MSG_UNICAST_WORKQUEUE ||
+			      type == NLBENCH_MSG_MULTICAST_WORKQUEUE) &&
+			     !unbound);
+
+		if (!(process && duration == 0) &&
+		    !(bound && prodcpu >= 0 && duration > 0)) {
+			fprintf(stderr, "ERROR: -e needs a process-mode "
+				"request without -d, or a bound workqueue, "
+				"kthread or process request with -P and -d\n");
+			exit(EXIT_FAILURE);
+		}
+		/* a timed run is measured against its own job's counts */
+		if (duration > 0 && batch > 1) {
+			fprintf(stderr, "ERROR: -e with -d counts a single "
+				"job, it cannot be combined with -B\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	printf("num_msgs=%u size=%u randomsecs=%u\n",
 		args[0], args[1], args[2]);
+	if (groups > 1)
+		printf("groups=%u sharding=%s\n", groups,
+			keys > 0 ? "key" : "round-robin");
 
 	if (cpuaffinity >= 0) {
 		cpu_set_t cpuset;
@@ -120,36 +454,149 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	nlh = libnetlink_newmsg(type, 0, 1024);
-	if (nlh == NULL) {
-		perror("calloc");
-		exit(EXIT_FAILURE);
+	if (timeout >= 0)
+		printf("blocking delivery, timeout=%d msecs\n", timeout);
+	if (duration > 0)
+		printf("duration=%d secs\n", duration);
+	if (attrs > 0)
+		printf("attrs=%d depth=%d attr_size=%d\n",
+			attrs, depth, attrsize);
+	if (batch > 1)
+		printf("batch=%d requests per sendmsg\n", batch);
+
+	/* the same request @batch times over, sent in one go below */
+	libnetlink_buf_init(&req, reqbuf, sizeof(reqbuf), time(NULL));
+	for (i = 0; i < batch; i++) {
+		ret = libnetlink_buf_msg(&req, type, 0) == NULL;
+		ret |= libnetlink_buf_attr(&req, NLB_NUM, &args[0], sizeof(int));
+		ret |= libnetlink_buf_attr(&req, NLB_SIZE, &args[1], sizeof(int));
+		ret |= libnetlink_buf_attr(&req, NLB_RANDOM, &args[2], sizeof(int));
+		if (flags & (1 << 3))
+			ret |= libnetlink_buf_attr(&req, NLB_PID,
+						   &args[3], sizeof(int));
+		if (groups > 1 || keys > 0) {
+			shard = keys > 0 ? NLBENCH_SHARD_KEY : NLBENCH_SHARD_RR;
+			ret |= libnetlink_buf_attr(&req, NLB_GROUPS,
+						   &groups, sizeof(int));
+			ret |= libnetlink_buf_attr(&req, NLB_SHARD,
+						   &shard, sizeof(int));
+			ret |= libnetlink_buf_attr(&req, NLB_KEYS,
+						   &keys, sizeof(int));
+		}
+		if (timeout >= 0)
+			ret |= libnetlink_buf_attr(&req, NLB_TIMEOUT,
+						   &timeout, sizeof(int));
+		if (prodcpu >= 0)
+			ret |= libnetlink_buf_attr(&req, NLB_CPU,
+						   &prodcpu, sizeof(int));
+		if (unbound)
+			ret |= libnetlink_buf_attr(&req, NLB_UNBOUND, NULL, 0);
+		if (duration > 0)
+			ret |= libnetlink_buf_attr(&req, NLB_DURATION,
+						   &duration, sizeof(int));
+		if (rate > 0)
+			ret |= libnetlink_buf_attr(&req, NLB_RATE,
+						   &rate, sizeof(int));
+		if (attrs > 0) {
+			ret |= libnetlink_buf_attr(&req, NLB_ATTRS,
+						   &attrs, sizeof(int));
+			ret |= libnetlink_buf_attr(&req, NLB_DEPTH,
+						   &depth, sizeof(int));
+			ret |= libnetlink_buf_attr(&req, NLB_ATTR_SIZE,
+						   &attrsize, sizeof(int));
+		}
+		if (ret) {
+			fprintf(stderr, "ERROR: batch of %d does not fit "
+				"in %zu bytes\n", batch, sizeof(reqbuf));
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	libnetlink_addattr(nlh, NLB_NUM, &args[0], sizeof(int));
-	libnetlink_addattr(nlh, NLB_SIZE, &args[1], sizeof(int));
-	libnetlink_addattr(nlh, NLB_RANDOM, &args[2], sizeof(int));
-	if (flags & (1 << 3))
-		libnetlink_addattr(nlh, NLB_PID, &args[3], sizeof(int));
+	if (query_stats(fd, before) < 0)
+		memset(before, 0, sizeof(before));
 
-	if (libnetlink_send(fd, nlh) < 0) {
-		perror("send");
-		exit(EXIT_FAILURE);
+	if (counters) {
+		if (duration > 0 ? perf_open(&perf, -1, prodcpu) :
+				   perf_open(&perf, 0, -1)) {
+			perror("perf_event_open");
+			exit(EXIT_FAILURE);
+		}
+		printf("counting %s events%s\n",
+		       perf.hw ? "hardware" : "software",
+		       perf.kernel ? "" : " (user space only)");
+		perf_read(&perf, perf_before);
 	}
 
-	if (libnetlink_recv(fd, buf, sizeof(buf)) < 0) {
-		perror("recv");
+	gettimeofday(&start, NULL);
+
+	if (libnetlink_buf_send(fd, &req) < 0) {
+		perror("send");
 		exit(EXIT_FAILURE);
 	}
 
-	{
-		struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
-		struct nlmsgerr *err = NLMSG_DATA(nlh);
-		if (nlh->nlmsg_type == NLMSG_ERROR && err->error != 0) {
-			printf("Error: %s\n", strerror(-err->error));
+	/* one ACK per packed request, keep the first error */
+	for (i = 0, ret = 0; i < batch; i++) {
+		int err = recv_ack(fd, &js);
+
+		if (err < 0 && ret == 0)
+			ret = err;
+	}
+	gettimeofday(&stop, NULL);
+	if (ret < 0) {
+		printf("Error: %s\n", strerror(-ret));
+		/* process-mode requests still report what got through */
+		if (ret != -ETIMEDOUT && ret != -ENOMEM)
 			exit(EXIT_FAILURE);
-		}
+	} else
+		printf("Request succesfully sent.\n");
+
+	/* process-mode requests are done once they are acknowledged */
+	if ((type == NLBENCH_MSG_UNICAST_PROCESS ||
+	     type == NLBENCH_MSG_MULTICAST_PROCESS) && duration == 0) {
+		double secs;
+
+		timersub(&stop, &start, &stop);
+		secs = stop.tv_sec + stop.tv_usec / 1e6;
+		printf("elapsed=%.6f secs rate=%.0f msgs/s\n",
+			secs, secs > 0 ? (double)args[0] * batch / secs : 0);
+	}
+
+	/* a timed job is still running, count it until it is over */
+	if (counters && duration > 0 && ret == 0) {
+		sleep(duration);
+		ret = wait_job(fd, &js);
+		if (ret < 0)
+			printf("Error: %s\n", strerror(-ret));
+	}
+	if (counters)
+		perf_read(&perf, perf_after);
+
+	if (query_stats(fd, after) == 0) {
+		for (i = 0; i <= NLB_STATS_MAX; i++)
+			after[i] -= before[i];
+		print_stats(after);
+	} else
+		memset(after, 0, sizeof(after));
+
+	if (counters) {
+		char buf[256];
+		uint64_t msgs;
+
+		for (i = 0; i < PERF_MAX; i++)
+			perf_after[i] -= perf_before[i];
+		/*
+		 * Every message the producer built, delivered or not. Other
+		 * jobs in the netns show up in the stats, a timed run only
+		 * counts its own.
+		 */
+		if (duration > 0)
+			msgs = js.sent + js.dropped;
+		else
+			msgs = after[NLB_STATS_SENT] + after[NLB_STATS_DROPPED];
+		perf_summary(&perf, perf_after, msgs, buf);
+		printf("%s\n", buf);
+		perf_close(&perf);
 	}
 
-	printf("Request succesfully sent.\n");
+	exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 }
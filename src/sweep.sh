@@ -0,0 +1,270 @@
+#!/bin/bash
+#
+# Receiver scheduling sweep for netlinkbench.
+#
+# Runs a timed nlbenchsend job with the producer bound to one CPU and an
+# nlbenchrecv for every combination of scheduling policy, priority, where
+# the receiver runs relative to the producer (same core, SMT sibling, same
+# socket, remote NUMA node) and blocking versus busy-poll receive. Reports
+# the events/s and the kernel-timestamp-to-userspace latency of each.
+#
+# Placements the machine does not have are skipped. The kthread producers
+# are SCHED_FIFO at priority 50 and RT throttling only ever frees CPU time
+# for normal tasks, so on the producer's CPU a busy-polling fifo/rr
+# receiver above it (or a fifo one at 50) starves the producer, and an
+# unpaced producer starves a fifo/rr receiver below it (or a fifo one at
+# 50). Those runs are skipped and reported as starved.
+#
+# Needs root and the nlbench module loaded.
+#
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+POLICIES="other fifo rr"
+PRIOS="1 50 99"
+NICES="0 -20"
+PLACES="same smt socket numa"
+MODES="block busypoll"
+TYPE=multicast-kthread
+PCPU=0
+# sched_set_fifo() of the kthread producers
+FIFO_PRIO=50
+# the kernel timestamp takes the first 8 bytes of the payload
+MIN_SIZE=8
+SIZE=$MIN_SIZE
+SECS=5
+RATE=0
+OUT=$(mktemp -d /tmp/sweep.XXXXXX)
+
+usage()
+{
+	echo "Usage: $0 [options]"
+	echo "-p	policies to try (default \"$POLICIES\")"
+	echo "-r	priorities for fifo and rr (default \"$PRIOS\")"
+	echo "-N	nice values for other (default \"$NICES\")"
+	echo "-l	placements to try (default \"$PLACES\")"
+	echo "-m	receive modes to try (default \"$MODES\")"
+	echo "-t	nlbenchsend type (default $TYPE)"
+	echo "-c	CPU the producer is bound to (default $PCPU)"
+	echo "-s	size of messages (in bytes, at least $MIN_SIZE)"
+	echo "-d	duration of each run (in secs)"
+	echo "-R	messages per second (default unpaced)"
+	echo "-h	show this help"
+}
+
+topo()
+{
+	cat "/sys/devices/system/cpu/cpu$1/topology/$2" 2>/dev/null
+}
+
+node()
+{
+	local n
+
+	for n in /sys/devices/system/cpu/cpu"$1"/node*; do
+		[ -e "$n" ] && echo "${n##*node}" && return
+	done
+	echo 0
+}
+
+# expand a list such as "0-3,8" as found in sysfs
+cpulist()
+{
+	local r
+
+	for r in ${1//,/ }; do
+		seq "${r%-*}" "${r#*-}"
+	done
+}
+
+# the receiver CPU for a placement, nothing if there is none
+place()
+{
+	local cpu siblings
+
+	siblings=$(cpulist "$(topo "$PCPU" thread_siblings_list)")
+	case $1 in
+	same)
+		echo "$PCPU"
+		return
+		;;
+	smt)
+		for cpu in $siblings; do
+			[ "$cpu" != "$PCPU" ] && echo "$cpu" && return
+		done
+		return
+		;;
+	esac
+
+	for cpu in $(cpulist "$(cat /sys/devices/system/cpu/online)"); do
+		case $1 in
+		socket)
+			echo " $siblings " | grep -q " $cpu " && continue
+			[ "$(topo "$cpu" physical_package_id)" = \
+			  "$(topo "$PCPU" physical_package_id)" ] &&
+				echo "$cpu" && return
+			;;
+		numa)
+			[ "$(node "$cpu")" != "$(node "$PCPU")" ] &&
+				echo "$cpu" && return
+			;;
+		esac
+	done
+}
+
+# name the side that would get no CPU with an RT receiver next to the
+# FIFO kthread producer, fail if they can share it
+starved()
+{
+	local policy=$1 prio=$2 where=$3 mode=$4
+
+	[ "$where" = same ] || return 1
+	case $TYPE in
+	*-kthread) ;;
+	*) return 1 ;;
+	esac
+	case $policy in
+	fifo|rr) ;;
+	*) return 1 ;;
+	esac
+
+	# equal FIFO priorities never preempt each other
+	if [ "$mode" = busypoll ]; then
+		[ "$prio" -gt "$FIFO_PRIO" ] && echo producer && return 0
+		[ "$policy" = fifo ] && [ "$prio" -eq "$FIFO_PRIO" ] &&
+			echo producer && return 0
+	fi
+	if [ "$RATE" -eq 0 ]; then
+		[ "$prio" -lt "$FIFO_PRIO" ] && echo receiver && return 0
+		[ "$policy" = fifo ] && [ "$prio" -eq "$FIFO_PRIO" ] &&
+			echo receiver && return 0
+	fi
+	return 1
+}
+
+run()
+{
+	local policy=$1 prio=$2 where=$3 mode=$4 cpu opts dst recv f job line
+	local who
+
+	cpu=$(place "$where")
+	if [ -z "$cpu" ]; then
+		printf "%-6s\t%5s\t%-7s\t%4s\t%-8s\t%12s\t%12s\t%12s\n" \
+			"$policy" "$prio" "$where" "-" "$mode" "n/a" "n/a" "n/a"
+		return 0
+	fi
+	if who=$(starved "$policy" "$prio" "$where" "$mode"); then
+		printf "%-6s\t%5s\t%-7s\t%4s\t%-8s\t%12s\t%12s\t%12s\n" \
+			"$policy" "$prio" "$where" "$cpu" "$mode" \
+			"starved" "$who" "-"
+		return 0
+	fi
+
+	opts="-c $cpu -l"
+	case $policy in
+	other)	opts="$opts -n $prio" ;;
+	*)	opts="$opts -s $policy -p $prio" ;;
+	esac
+	[ "$mode" = busypoll ] && opts="$opts -B"
+
+	f="$OUT/recv.$policy.$prio.$where.$mode"
+	# the receiver runs until the job has finished, then is stopped
+	"$DIR/nlbenchrecv" $opts -f "$f" > /dev/null &
+	recv=$!
+	sleep 1
+
+	dst=""
+	case $TYPE in
+	unicast-*) dst="-p $recv" ;;
+	esac
+	# nlbenchsend only binds the producer, it returns once the job started
+	if ! "$DIR/nlbenchsend" -t "$TYPE" -P "$PCPU" -s "$SIZE" \
+		-d "$SECS" -R "$RATE" $dst > "$f.send"; then
+		kill $recv
+		wait $recv
+		return 1
+	fi
+
+	job=$(sed -n 's/^job=\([0-9]*\) .*/\1/p' "$f.send")
+	while [ -n "$job" ]; do
+		line=$("$DIR/nlbenchsend" -t job -j "$job" | grep "^job=")
+		case $line in
+		*state=running*) sleep 1 ;;
+		*) break ;;
+		esac
+	done
+	kill -TERM $recv
+	wait $recv
+	if [ -z "$line" ]; then
+		echo "job of $policy/$prio/$where/$mode is gone:" >&2
+		cat "$f.send" >&2
+		return 1
+	fi
+	echo "$line" > "$f.job"
+
+	# events/s over the job's own run time, not the receiver's
+	awk -v p="$policy" -v pr="$prio" -v w="$where" -v c="$cpu" \
+	    -v m="$mode" '
+		FILENAME ~ /\.job$/ {
+			for (i = 1; i <= NF; i++)
+				if ($i ~ /^elapsed=/) {
+					split($i, a, "="); secs = a[2]
+				}
+			next
+		}
+		/^# total_events=/ { split($2, a, "="); ev = a[2] }
+		/^# avg_latency_us=/ {
+			split($2, a, "="); avg = a[2]
+			split($3, a, "="); max = a[2]
+		}
+		END {
+			printf "%-6s\t%5s\t%-7s\t%4s\t%-8s\t%12.0f", \
+				p, pr, w, c, m, (secs > 0 ? ev / secs : 0)
+			if (avg == "n/a" || avg == "")
+				printf "\t%12s\t%12s\n", "n/a", "n/a"
+			else
+				printf "\t%12.3f\t%12.3f\n", avg, max
+		}' "$f.job" "$f"
+}
+
+while getopts "p:r:N:l:m:t:c:s:d:R:h" opt; do
+	case $opt in
+	p) POLICIES=$OPTARG ;;
+	r) PRIOS=$OPTARG ;;
+	N) NICES=$OPTARG ;;
+	l) PLACES=$OPTARG ;;
+	m) MODES=$OPTARG ;;
+	t) TYPE=$OPTARG ;;
+	c) PCPU=$OPTARG ;;
+	s) SIZE=$OPTARG ;;
+	d) SECS=$OPTARG ;;
+	R) RATE=$OPTARG ;;
+	h) usage; exit 0 ;;
+	*) usage; exit 1 ;;
+	esac
+done
+
+if [ "$SIZE" -lt "$MIN_SIZE" ]; then
+	echo "messages below $MIN_SIZE bytes carry no timestamp," \
+		"there would be no latency to report" >&2
+	exit 1
+fi
+
+trap 'kill $(jobs -p) 2>/dev/null; exit 1' INT TERM
+
+echo "# type=$TYPE producer_cpu=$PCPU size=$SIZE secs=$SECS rate=$RATE" \
+	"output=$OUT"
+echo "# policy	 prio	place  	 cpu	mode    	    events/s	  avg_lat_us	  max_lat_us"
+for policy in $POLICIES; do
+	if [ "$policy" = other ]; then
+		prios=$NICES
+	else
+		prios=$PRIOS
+	fi
+	for prio in $prios; do
+		for where in $PLACES; do
+			for mode in $MODES; do
+				run "$policy" "$prio" "$where" "$mode" || exit 1
+			done
+		done
+	done
+done